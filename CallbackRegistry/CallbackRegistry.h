@@ -0,0 +1,156 @@
+#pragma once
+
+#include "../SlotMapExample/DenseSlotMap.h"
+#include "../FixedSizeDelegates/Delegate.h"
+
+#include <vector>
+#include <utility>
+#include <type_traits>
+#include <cassert>
+#include <cstddef>
+
+// event bus for lots of listeners: every subscriber is a delegate stored in a
+// dense_slot_map, so a subscription is a generational handle like
+// v4::object_id instead of a pointer or an index that shifts around.
+// unsubscribing with a stale handle (twice, or after clear(), or from a
+// listener that was never told it got dropped) is a safe no-op, and raising
+// the event is one linear walk over the packed delegates, with no holes to
+// skip and nothing to chase.  the delegates keep their functors inline, and
+// reserve() sizes everything up front, so after that subscribing,
+// unsubscribing and raising never allocate.
+// this is multicast_delegate grown up: that one is sized for a handful of
+// subscribers living inside the object that owns the event; this one is for
+// hundreds of thousands, with the slot map's handle layouts and retirement
+// policies, and handles that can't be mixed up between registries of
+// different types.
+// same rules on reentrancy as multicast_delegate: callbacks may unsubscribe
+// themselves or anyone else, which disarms the subscriber right away and
+// erases it once the outermost invoke returns, but can't subscribe, since
+// growing the dense array would move the delegate that's running.
+//
+//    callback_registry<void(const damage_event&)> on_damage;
+//    on_damage.reserve(100000);
+//    auto id = on_damage.subscribe([this](const damage_event& e) { react(e); });
+//    on_damage(e);
+//    on_damage.unsubscribe(id);
+template <typename Signature, size_t Size = sizeof(void*) * 3, size_t Align = std::alignment_of<double>::value, typename Layout = handle_layout<> >
+class callback_registry;
+
+template <typename... Args, size_t Size, size_t Align, typename Layout>
+class callback_registry<void(Args...), Size, Align, Layout>
+{
+public:
+	typedef delegate<void(Args...), Size, Align> delegate_type;
+	typedef dense_slot_map<delegate_type, Layout> map_type;
+	typedef typename map_type::handle handle;
+
+	callback_registry() : invoking(0) {}
+
+	callback_registry(const callback_registry&) = delete;
+	callback_registry& operator=(const callback_registry&) = delete;
+
+	// binds a functor, same rules as delegate::make.
+	template <typename Functor>
+	typename std::enable_if<!std::is_same<typename std::decay<Functor>::type, delegate_type>::value, handle>::type subscribe(Functor&& functor)
+	{
+		return subscribe(delegate_type::make(std::forward<Functor>(functor)));
+	}
+
+	// adds an already bound delegate, which must not be empty.  returns a
+	// default handle if every index the handle layout allows is in use.
+	handle subscribe(delegate_type target)
+	{
+		assert(invoking == 0 && "can't subscribe from inside a callback");
+		assert(!target.empty());
+
+		return listeners.create(std::move(target));
+	}
+
+	// O(1).  returns false, and does nothing, for stale handles.
+	bool unsubscribe(handle id)
+	{
+		delegate_type* target = listeners.get(id);
+		if (target == nullptr || disarmed(*target))
+			return false;
+
+		if (invoking != 0)
+		{
+			// might be the one that's running, so only its invoker is
+			// swapped for a no-op; the functor stays put until the
+			// outermost invoke erases it.
+			target->invoker = &skip;
+			removed.push_back(id);
+		}
+		else
+		{
+			listeners.destroy(id);
+		}
+		return true;
+	}
+
+	bool contains(handle id) const
+	{
+		const delegate_type* target = listeners.get(id);
+		return target != nullptr && !disarmed(*target);
+	}
+
+	// calls every subscriber, in no particular order.  arguments are passed
+	// on as lvalues, since there's more than one receiver.
+	template <typename... CallArgs>
+	void operator()(CallArgs&&... args)
+	{
+		++invoking;
+
+		size_t count = listeners.size();
+		delegate_type* targets = listeners.data();
+		for (size_t i = 0; i < count; ++i)
+			targets[i].invoker(targets[i].buffer, args...);
+
+		if (--invoking == 0 && !removed.empty())
+			sweep();
+	}
+
+	size_t size() const { return listeners.size() - removed.size(); }
+	bool empty() const { return size() == 0; }
+
+	// room for count subscribers, including the bookkeeping for the ones
+	// that unsubscribe from inside a callback.
+	void reserve(size_t count)
+	{
+		listeners.reserve(count);
+		removed.reserve(count);
+	}
+
+	// drops every subscriber.  all outstanding handles go stale.
+	void clear()
+	{
+		assert(invoking == 0 && "can't clear from inside a callback");
+
+		while (!listeners.empty())
+			listeners.destroy(listeners.handle_at(listeners.size() - 1));
+	}
+
+	// the underlying map, for walking the subscribers or looking one up.
+	const map_type& map() const { return listeners; }
+
+private:
+	static void skip(void*, Args...) {}
+
+	static bool disarmed(const delegate_type& target)
+	{
+		return target.invoker == &skip;
+	}
+
+	// erases whatever was unsubscribed during an invoke.  the handles stay
+	// live until now, which is what keeps the disarmed delegates in place.
+	void sweep()
+	{
+		for (size_t i = 0; i < removed.size(); ++i)
+			listeners.destroy(removed[i]);
+		removed.clear();
+	}
+
+	map_type listeners;
+	std::vector<handle> removed;
+	unsigned invoking;
+};
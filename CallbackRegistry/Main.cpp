@@ -0,0 +1,312 @@
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <utility>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+
+#include "CallbackRegistry.h"
+#include "../FixedSizeDelegates/MulticastDelegate.h"
+
+// callback_registry checks, then a benchmark of it against the two usual
+// ways of keeping a big listener list: a std::vector of std::function with an
+// id next to each, unsubscribed by searching for the id and erasing, and
+// multicast_delegate.  per implementation this measures subscribing all the
+// listeners, raising the event, unsubscribing a random sample of them, and
+// unsubscribing the same sample again with the now stale ids, all in ns per
+// operation (per listener called, for raise).
+// usage: CallbackRegistry [listeners] [calls]
+// 100K listeners and 10M listener calls by default.  build in Release; the
+// numbers from a debug build are meaningless.
+
+static long long checksum = 0;
+
+typedef std::chrono::steady_clock bench_clock;
+
+template <typename Body>
+double measure(Body body)
+{
+	bench_clock::time_point begin = bench_clock::now();
+	body();
+	bench_clock::time_point end = bench_clock::now();
+	return std::chrono::duration<double, std::nano>(end - begin).count();
+}
+
+// [&sum, k](int x) { sum += x * k; }
+struct accumulate
+{
+	long long* sum;
+	int k;
+
+	void operator()(int x) const { *sum += x * k; }
+};
+
+void test_registry()
+{
+	typedef callback_registry<void(int)> registry;
+
+	long long sum = 0;
+	registry on_event;
+	assert(on_event.empty());
+
+	registry::handle a = on_event.subscribe(accumulate{ &sum, 1 });
+	registry::handle b = on_event.subscribe(accumulate{ &sum, 10 });
+	registry::handle c = on_event.subscribe(accumulate{ &sum, 100 });
+	assert(on_event.size() == 3);
+	assert(on_event.contains(a) && on_event.contains(b) && on_event.contains(c));
+
+	on_event(2);
+	assert(sum == 222);
+
+	// unsubscribing is O(1), and doing it again, or with a default
+	// handle, is a no-op.
+	bool removed = on_event.unsubscribe(b);
+	bool removed_again = on_event.unsubscribe(b);
+	bool removed_default = on_event.unsubscribe(registry::handle());
+	assert(removed && !removed_again && !removed_default);
+	(void)removed_default;
+	assert(!on_event.contains(b));
+	assert(on_event.size() == 2);
+
+	sum = 0;
+	on_event(1);
+	assert(sum == 101);
+
+	// the slot is recycled with a new generation, so b stays stale.
+	registry::handle d = on_event.subscribe(accumulate{ &sum, 1000 });
+	assert(d.index() == b.index());
+	assert(d != b);
+	removed_again = on_event.unsubscribe(b);
+	assert(!removed_again);
+	assert(on_event.contains(d));
+
+	// a listener removing itself and another one mid-raise: both are
+	// skipped from then on, and the rest still run exactly once.
+	struct unsubscriber
+	{
+		registry* owner;
+		registry::handle self;
+		registry::handle other;
+		int calls;
+	} state = { &on_event, registry::handle(), a, 0 };
+	unsubscriber* watch = &state;
+	state.self = on_event.subscribe([watch](int) { ++watch->calls; watch->owner->unsubscribe(watch->self); watch->owner->unsubscribe(watch->other); });
+	registry::handle self = state.self;
+	int& self_calls = state.calls;
+	assert(on_event.size() == 4);
+
+	sum = 0;
+	on_event(1);
+	assert(self_calls == 1);
+	assert(!on_event.contains(self) && !on_event.contains(a));
+	assert(on_event.size() == 2);
+	// a may or may not have run before self, depending on the order.
+	assert(sum == 1100 || sum == 1101);
+
+	sum = 0;
+	on_event(1);
+	assert(self_calls == 1);
+	assert(sum == 1100);
+	(void)self;
+	(void)self_calls;
+
+	// clear makes every handle stale.
+	on_event.clear();
+	assert(on_event.empty());
+	assert(!on_event.contains(c) && !on_event.contains(d));
+	(void)d;
+	removed_again = on_event.unsubscribe(c);
+	assert(!removed_again);
+	(void)removed_again;
+
+	// and a lot of them, with reserve up front.
+	on_event.reserve(10000);
+	std::vector<registry::handle> ids;
+	for (int i = 0; i < 10000; ++i)
+		ids.push_back(on_event.subscribe(accumulate{ &sum, 1 }));
+	for (int i = 0; i < 10000; i += 2)
+	{
+		removed = on_event.unsubscribe(ids[i]);
+		assert(removed);
+	}
+	(void)removed;
+
+	sum = 0;
+	on_event(1);
+	assert(sum == 5000);
+	for (int i = 0; i < 10000; ++i)
+		assert(on_event.contains(ids[i]) == ((i & 1) != 0));
+}
+
+// adaptors giving every listener list the same interface.
+
+struct std_function_impl
+{
+	typedef unsigned id;
+	static const char* name() { return "vector<std::function>"; }
+
+	struct listener
+	{
+		id owner;
+		std::function<void(int)> call;
+	};
+
+	std::vector<listener> listeners;
+	id next_id;
+
+	std_function_impl() : next_id(1) {}
+
+	void reserve(size_t count) { listeners.reserve(count); }
+
+	id subscribe(const accumulate& a)
+	{
+		listener l = { next_id, a };
+		listeners.push_back(std::move(l));
+		return next_id++;
+	}
+
+	// the manual way: find it, and erase it, keeping the order.
+	bool unsubscribe(id owner)
+	{
+		std::vector<listener>::iterator found = std::find_if(listeners.begin(), listeners.end(), [owner](const listener& l) { return l.owner == owner; });
+		if (found == listeners.end())
+			return false;
+
+		listeners.erase(found);
+		return true;
+	}
+
+	void raise(int x)
+	{
+		for (size_t i = 0; i < listeners.size(); ++i)
+			listeners[i].call(x);
+	}
+};
+
+struct multicast_impl
+{
+	typedef multicast_delegate<void(int)>::subscription id;
+	static const char* name() { return "multicast_delegate"; }
+
+	multicast_delegate<void(int)> listeners;
+
+	void reserve(size_t) {}
+
+	id subscribe(const accumulate& a) { return listeners.subscribe(a); }
+
+	bool unsubscribe(id owner)
+	{
+		if (!listeners.contains(owner))
+			return false;
+
+		listeners.unsubscribe(owner);
+		return true;
+	}
+
+	void raise(int x) { listeners(x); }
+};
+
+struct registry_impl
+{
+	typedef callback_registry<void(int)>::handle id;
+	static const char* name() { return "callback_registry"; }
+
+	callback_registry<void(int)> listeners;
+
+	void reserve(size_t count) { listeners.reserve(count); }
+
+	id subscribe(const accumulate& a) { return listeners.subscribe(a); }
+
+	bool unsubscribe(id owner) { return listeners.unsubscribe(owner); }
+
+	void raise(int x) { listeners(x); }
+};
+
+enum operation { op_subscribe, op_raise, op_unsubscribe, op_stale, op_count };
+
+static const char* operation_names[op_count] = { "subscribe", "raise", "unsubscribe", "stale unsub" };
+
+// listeners unsubscribed per measurement; vector<std::function> is O(n) per
+// unsubscribe, so this is kept well below the listener count.
+static const size_t sample_size = 1000;
+
+template <typename Impl>
+void run(size_t listeners, size_t calls)
+{
+	std::printf("%-24s", Impl::name());
+
+	double results[op_count] = {};
+	long long sum = 0;
+
+	Impl impl;
+	impl.reserve(listeners);
+	std::vector<typename Impl::id> ids;
+	ids.reserve(listeners);
+
+	results[op_subscribe] = measure([&]()
+	{
+		for (size_t i = 0; i < listeners; ++i)
+			ids.push_back(impl.subscribe(accumulate{ &sum, static_cast<int>(i & 7) + 1 }));
+	}) / listeners;
+
+	size_t rounds = calls / listeners > 0 ? calls / listeners : 1;
+	results[op_raise] = measure([&]()
+	{
+		for (size_t r = 0; r < rounds; ++r)
+			impl.raise(static_cast<int>(r));
+	}) / (rounds * listeners);
+
+	// the same random sample for every implementation.
+	std::mt19937 rng(12345);
+	std::shuffle(ids.begin(), ids.end(), rng);
+	size_t sample = std::min(sample_size, listeners);
+
+	size_t unsubscribed = 0;
+	results[op_unsubscribe] = measure([&]()
+	{
+		for (size_t i = 0; i < sample; ++i)
+			unsubscribed += impl.unsubscribe(ids[i]) ? 1 : 0;
+	}) / sample;
+
+	results[op_stale] = measure([&]()
+	{
+		for (size_t i = 0; i < sample; ++i)
+			unsubscribed += impl.unsubscribe(ids[i]) ? 1 : 0;
+	}) / sample;
+
+	assert(unsubscribed == sample);
+	impl.raise(1);
+	checksum += sum + static_cast<long long>(unsubscribed);
+
+	for (int op = 0; op < op_count; ++op)
+		std::printf("  %11.2f", results[op]);
+	std::printf("\n");
+	std::fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+	test_registry();
+
+	size_t listeners = argc > 1 ? static_cast<size_t>(std::strtoull(argv[1], nullptr, 10)) : 100000;
+	size_t calls = argc > 2 ? static_cast<size_t>(std::strtoull(argv[2], nullptr, 10)) : 10000000;
+	if (listeners == 0)
+		listeners = 1;
+
+	std::printf("%u listeners, ns per operation; sizes: std::function %u, delegate %u bytes\n",
+		static_cast<unsigned>(listeners), static_cast<unsigned>(sizeof(std::function<void(int)>)), static_cast<unsigned>(sizeof(delegate<void(int)>)));
+	std::printf("%-24s", "listener list");
+	for (int op = 0; op < op_count; ++op)
+		std::printf("  %11s", operation_names[op]);
+	std::printf("\n");
+
+	run<std_function_impl>(listeners, calls);
+	run<multicast_impl>(listeners, calls);
+	run<registry_impl>(listeners, calls);
+
+	std::printf("\nchecksum %lld\n", checksum);
+	return 0;
+}
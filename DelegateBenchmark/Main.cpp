@@ -0,0 +1,355 @@
+#include <vector>
+#include <memory>
+#include <functional>
+#include <random>
+#include <chrono>
+#include <utility>
+#include <type_traits>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../FixedSizeDelegates/Delegate.h"
+
+// micro-benchmarks for delegate against the usual alternatives: std::function,
+// plain function pointers, and a virtual interface.  for three kinds of
+// callable (captureless, small capture, bound by reference) this measures
+// invoke cost through a monomorphic call site (every callable in the array
+// has the same target) and a megamorphic one (eight targets in random order,
+// so the indirect branch predictor has to work for it), plus construction,
+// copy, move, and destruction.  everything is reported in ns per callable.
+// usage: DelegateBenchmark [calls]
+// calls is the number of invokes (and constructions, copies, and so on) per
+// measurement, 10M by default.  build in Release; the numbers from a debug
+// build are meaningless.
+
+// everything gets folded into this and printed at the end, so that the
+// compiler can't throw away calls whose results are unused.
+static long long checksum = 0;
+
+typedef std::chrono::steady_clock bench_clock;
+
+template <typename Body>
+double measure(Body body)
+{
+	bench_clock::time_point begin = bench_clock::now();
+	body();
+	bench_clock::time_point end = bench_clock::now();
+	return std::chrono::duration<double, std::nano>(end - begin).count();
+}
+
+// the callables.  N gives eight distinct types (and so eight distinct call
+// targets) of each kind, for the megamorphic case.  these are written as
+// structs so they can be templated, but are exactly what the compiler makes
+// of the equivalent lambdas.
+
+// [](int x) { return x * 3 + 1; }
+template <int N>
+struct captureless
+{
+	int operator()(int x) const { return x * (N + 2) + 1; }
+
+	// for the function pointer versions.
+	static int call(int x) { return x * (N + 2) + 1; }
+};
+
+// [a, b](int x) { return x * a + b; }
+template <int N>
+struct small_capture
+{
+	int a;
+	int b;
+
+	small_capture() : a(N + 2), b(N) {}
+
+	int operator()(int x) const { return x * a + b; }
+};
+
+// the functors bound by reference; one per target, living forever.
+template <int N>
+small_capture<N>& referenced()
+{
+	static small_capture<N> functor;
+	return functor;
+}
+
+enum kind { kind_captureless, kind_small_capture, kind_by_reference, kind_count };
+
+static const char* kind_names[kind_count] = { "captureless", "small capture", "by reference" };
+
+// the virtual interface version of a callback, the way a lot of engines do
+// listeners.  owned through a unique_ptr, so every callable is a heap object.
+struct callback
+{
+	virtual ~callback() {}
+	virtual int call(int x) = 0;
+};
+
+template <typename Functor>
+struct callback_value : callback
+{
+	Functor functor;
+	virtual int call(int x) { return functor(x); }
+};
+
+template <typename Functor>
+struct callback_reference : callback
+{
+	Functor* functor;
+	explicit callback_reference(Functor* functor) : functor(functor) {}
+	virtual int call(int x) { return (*functor)(x); }
+};
+
+// adaptors giving every callable the same interface.  make<N> builds the
+// callable for target N of a kind; lifecycle is false for the ones where
+// copy and move either don't exist or mean something else.
+
+struct function_pointer_impl
+{
+	typedef int (*type)(int);
+	static const char* name() { return "function pointer"; }
+	static const bool lifecycle = true;
+
+	static bool supports(kind k) { return k == kind_captureless; }
+
+	template <int N>
+	static type make(kind) { return &captureless<N>::call; }
+
+	static int call(type& f, int x) { return f(x); }
+};
+
+struct virtual_impl
+{
+	typedef std::unique_ptr<callback> type;
+	static const char* name() { return "virtual interface"; }
+	static const bool lifecycle = false;
+
+	static bool supports(kind) { return true; }
+
+	template <int N>
+	static type make(kind k)
+	{
+		switch (k)
+		{
+		case kind_captureless: return type(new callback_value<captureless<N> >());
+		case kind_small_capture: return type(new callback_value<small_capture<N> >());
+		default: return type(new callback_reference<small_capture<N> >(&referenced<N>()));
+		}
+	}
+
+	static int call(type& f, int x) { return f->call(x); }
+};
+
+struct std_function_impl
+{
+	typedef std::function<int(int)> type;
+	static const char* name() { return "std::function"; }
+	static const bool lifecycle = true;
+
+	static bool supports(kind) { return true; }
+
+	template <int N>
+	static type make(kind k)
+	{
+		switch (k)
+		{
+		case kind_captureless: return type(captureless<N>());
+		case kind_small_capture: return type(small_capture<N>());
+		default: return type(std::ref(referenced<N>()));
+		}
+	}
+
+	static int call(type& f, int x) { return f(x); }
+};
+
+template <typename Delegate>
+struct delegate_impl_base
+{
+	typedef Delegate type;
+	static const bool lifecycle = true;
+
+	static bool supports(kind) { return true; }
+
+	template <int N>
+	static type make(kind k)
+	{
+		switch (k)
+		{
+		case kind_captureless: return type::make(captureless<N>());
+		case kind_small_capture: return type::make(small_capture<N>());
+		default: return type::make_ref(referenced<N>());
+		}
+	}
+
+	static int call(type& f, int x) { return f(x); }
+};
+
+struct delegate_impl : delegate_impl_base<delegate<int(int)> >
+{
+	static const char* name() { return "delegate"; }
+};
+
+struct trivial_delegate_impl : delegate_impl_base<trivial_delegate<int(int)> >
+{
+	static const char* name() { return "trivial_delegate"; }
+};
+
+template <typename Impl>
+typename Impl::type make_target(int target, kind k)
+{
+	switch (target & 7)
+	{
+	case 0: return Impl::template make<0>(k);
+	case 1: return Impl::template make<1>(k);
+	case 2: return Impl::template make<2>(k);
+	case 3: return Impl::template make<3>(k);
+	case 4: return Impl::template make<4>(k);
+	case 5: return Impl::template make<5>(k);
+	case 6: return Impl::template make<6>(k);
+	default: return Impl::template make<7>(k);
+	}
+}
+
+enum operation { op_invoke_mono, op_invoke_mega, op_construct, op_copy, op_move, op_destroy, op_count };
+
+static const char* operation_names[op_count] = { "invoke mono", "invoke mega", "construct", "copy", "move", "destroy" };
+
+// callables per array; small enough that the array and its targets stay in
+// cache, since it's the call overhead we're after, not memory bandwidth.
+static const size_t array_size = 1024;
+
+template <typename Impl>
+double invoke_all(const std::vector<int>& targets, kind k, size_t calls)
+{
+	std::vector<typename Impl::type> callables;
+	for (size_t i = 0; i < array_size; ++i)
+		callables.push_back(make_target<Impl>(targets[i], k));
+
+	size_t rounds = calls / array_size > 0 ? calls / array_size : 1;
+	long long sum = 0;
+	double ns = measure([&]()
+	{
+		for (size_t r = 0; r < rounds; ++r)
+		{
+			for (size_t i = 0; i < array_size; ++i)
+				sum += Impl::call(callables[i], static_cast<int>(i));
+		}
+	});
+
+	checksum += sum;
+	return ns / (rounds * array_size);
+}
+
+// construction, copy, move, and destruction, each measured over whole arrays.
+template <typename Impl>
+void measure_lifecycle(double* results, const std::vector<int>& targets, kind k, size_t calls, std::true_type)
+{
+	// each round builds, copies, moves, and destroys a whole array.
+	// the vectors are reserved up front so only the callables'
+	// own costs get measured, not vector growth.
+	size_t rounds = calls / array_size > 0 ? calls / array_size : 1;
+	std::vector<typename Impl::type> built, copies, moved;
+	built.reserve(array_size);
+	copies.reserve(array_size);
+	moved.reserve(array_size);
+
+	for (size_t r = 0; r < rounds; ++r)
+	{
+		results[op_construct] += measure([&]()
+		{
+			for (size_t i = 0; i < array_size; ++i)
+				built.push_back(make_target<Impl>(targets[i], k));
+		});
+
+		results[op_copy] += measure([&]()
+		{
+			for (size_t i = 0; i < array_size; ++i)
+				copies.push_back(built[i]);
+		});
+
+		results[op_move] += measure([&]()
+		{
+			for (size_t i = 0; i < array_size; ++i)
+				moved.push_back(std::move(copies[i]));
+		});
+
+		checksum += Impl::call(moved[r % array_size], static_cast<int>(r));
+
+		// built and copies hold live (or moved-from) callables too,
+		// but only moved's destruction is timed.
+		results[op_destroy] += measure([&]()
+		{
+			moved.clear();
+		});
+
+		built.clear();
+		copies.clear();
+	}
+
+	for (int op = op_construct; op < op_count; ++op)
+		results[op] /= rounds * array_size;
+}
+
+template <typename Impl>
+void measure_lifecycle(double*, const std::vector<int>&, kind, size_t, std::false_type)
+{
+}
+
+// prints one row of results for one kind of callable.
+template <typename Impl>
+void run(kind k, size_t calls)
+{
+	std::printf("%-20s", Impl::name());
+	if (!Impl::supports(k))
+	{
+		std::printf("  (n/a)\n");
+		return;
+	}
+
+	std::mt19937 rng(12345);
+	std::vector<int> mono(array_size, 0);
+	std::vector<int> mega(array_size);
+	for (size_t i = 0; i < array_size; ++i)
+		mega[i] = static_cast<int>(rng() % 8);
+
+	double results[op_count] = {};
+	results[op_invoke_mono] = invoke_all<Impl>(mono, k, calls);
+	results[op_invoke_mega] = invoke_all<Impl>(mega, k, calls);
+
+	measure_lifecycle<Impl>(results, mega, k, calls, std::integral_constant<bool, Impl::lifecycle>());
+
+	for (int op = 0; op < op_count; ++op)
+	{
+		if (op >= op_construct && !Impl::lifecycle)
+			std::printf("  %11s", "-");
+		else
+			std::printf("  %11.2f", results[op]);
+	}
+	std::printf("\n");
+	std::fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+	size_t calls = argc > 1 ? static_cast<size_t>(std::strtoull(argv[1], nullptr, 10)) : 10000000;
+
+	std::printf("ns per callable; sizes: std::function %u, delegate %u, trivial_delegate %u bytes\n",
+		static_cast<unsigned>(sizeof(std::function<int(int)>)), static_cast<unsigned>(sizeof(delegate<int(int)>)), static_cast<unsigned>(sizeof(trivial_delegate<int(int)>)));
+
+	for (int k = 0; k < kind_count; ++k)
+	{
+		std::printf("\n=== %s ===\n", kind_names[k]);
+		std::printf("%-20s", "callable");
+		for (int op = 0; op < op_count; ++op)
+			std::printf("  %11s", operation_names[op]);
+		std::printf("\n");
+
+		run<function_pointer_impl>(static_cast<kind>(k), calls);
+		run<virtual_impl>(static_cast<kind>(k), calls);
+		run<std_function_impl>(static_cast<kind>(k), calls);
+		run<delegate_impl>(static_cast<kind>(k), calls);
+		run<trivial_delegate_impl>(static_cast<kind>(k), calls);
+	}
+
+	std::printf("\nchecksum %lld\n", checksum);
+	return 0;
+}
@@ -0,0 +1,171 @@
+// This code is released under the terms of the "CC0" license.  Full terms and conditions
+// can be found at: http://creativecommons.org/publicdomain/zero/1.0/
+
+#pragma once
+
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <cstddef>
+#include <cstdint>
+
+// queue of deferred calls, packed back to back in one linear block of memory.
+// where a std::vector<delegate> spends max_size + two pointers on every entry
+// whatever its size, and copies entries around when it grows, this stores each
+// functor in exactly as many bytes as it needs, behind a small header, and
+// never moves anything once it's pushed.
+// execute() is a single forward pass that calls each entry and destroys it
+// right after, and then resets the buffer, which is just rewinding a cursor;
+// the intended use is one buffer per frame (or per thread per frame) that
+// collects deferred events and is flushed at the frame boundary.
+// commands pushed from inside a command during execute() are run in the same
+// pass, after everything already queued; since the memory never moves, that's
+// safe.  push returns false when the buffer is full, and the functor is not
+// queued then.
+//
+//    command_buffer<void()> deferred(64 * 1024);
+//    deferred.push([this, id]() { despawn(id); });
+//    ...
+//    deferred.execute();
+template <typename Signature>
+class command_buffer;
+
+template <typename... Args>
+class command_buffer<void(Args...)>
+{
+public:
+	// owns a block of the given size, allocated once up front.
+	explicit command_buffer(size_t capacity)
+		: begin(static_cast<char*>(::operator new(capacity)))
+		, cursor(begin)
+		, end(begin + capacity)
+		, count(0)
+		, owned(true)
+	{}
+
+	// uses caller-provided memory (static storage, a frame arena, and so
+	// on), which must outlive the buffer and be aligned for every functor
+	// pushed.
+	command_buffer(void* memory, size_t capacity)
+		: begin(static_cast<char*>(memory))
+		, cursor(begin)
+		, end(begin + capacity)
+		, count(0)
+		, owned(false)
+	{}
+
+	~command_buffer()
+	{
+		clear();
+		if (owned)
+			::operator delete(begin);
+	}
+
+	command_buffer(const command_buffer&) = delete;
+	command_buffer& operator=(const command_buffer&) = delete;
+
+	// copies or moves the functor into the buffer.  any size works, as long
+	// as there's room.
+	template <typename Functor>
+	bool push(Functor&& functor)
+	{
+		typedef typename std::decay<Functor>::type functor_type;
+		static_assert(std::alignment_of<functor_type>::value <= alignof(std::max_align_t), "Functor alignment is too strict for command_buffer");
+
+		// the functor is aligned in absolute terms, not relative to the
+		// header, which is only pointer aligned.
+		std::uintptr_t header = reinterpret_cast<std::uintptr_t>(cursor);
+		size_t functor_offset = static_cast<size_t>(align(header + sizeof(entry), std::alignment_of<functor_type>::value) - header);
+		size_t next_offset = static_cast<size_t>(align(header + functor_offset + sizeof(functor_type), std::alignment_of<entry>::value) - header);
+		if (next_offset > static_cast<size_t>(end - cursor))
+			return false;
+
+		entry* e = new (cursor) entry;
+		e->run = &run_functor<functor_type>;
+		e->destroy = std::is_trivially_destructible<functor_type>::value ? nullptr : &destroy_functor<functor_type>;
+		e->functor_offset = static_cast<std::uint32_t>(functor_offset);
+		e->next_offset = static_cast<std::uint32_t>(next_offset);
+		new (cursor + functor_offset) functor_type(std::forward<Functor>(functor));
+
+		cursor += next_offset;
+		++count;
+		return true;
+	}
+
+	// calls every queued command in the order they were pushed, destroying
+	// each one as soon as it has run, then resets the buffer.  arguments are
+	// passed on as lvalues, since there's more than one receiver.
+	template <typename... CallArgs>
+	void execute(CallArgs&&... args)
+	{
+		// cursor is re-read every step to pick up commands pushed by
+		// the commands themselves.
+		for (char* position = begin; position != cursor; )
+		{
+			entry* e = reinterpret_cast<entry*>(position);
+			e->run(position + e->functor_offset, args...);
+			position += e->next_offset;
+		}
+
+		cursor = begin;
+		count = 0;
+	}
+
+	// drops every queued command without calling it.  O(1) unless some of
+	// them have destructors to run.
+	void clear()
+	{
+		for (char* position = begin; position != cursor; )
+		{
+			entry* e = reinterpret_cast<entry*>(position);
+			if (e->destroy != nullptr)
+				e->destroy(position + e->functor_offset);
+			position += e->next_offset;
+		}
+
+		cursor = begin;
+		count = 0;
+	}
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+
+	size_t bytes_used() const { return static_cast<size_t>(cursor - begin); }
+	size_t capacity() const { return static_cast<size_t>(end - begin); }
+
+private:
+	// header in front of every functor.  offsets are relative to the header
+	// itself; 32 bits is plenty, since no functor is anywhere near 4GB.
+	struct entry
+	{
+		void (*run)(void* functor, Args... args);
+		void (*destroy)(void* functor);
+		std::uint32_t functor_offset;
+		std::uint32_t next_offset;
+	};
+
+	static std::uintptr_t align(std::uintptr_t address, size_t alignment)
+	{
+		return (address + alignment - 1) & ~static_cast<std::uintptr_t>(alignment - 1);
+	}
+
+	template <typename T>
+	static void run_functor(void* functor, Args... args)
+	{
+		T& f = *static_cast<T*>(functor);
+		f(std::forward<Args>(args)...);
+		f.~T();
+	}
+
+	template <typename T>
+	static void destroy_functor(void* functor)
+	{
+		static_cast<T*>(functor)->~T();
+	}
+
+	char* begin;
+	char* cursor;
+	char* end;
+	size_t count;
+	bool owned;
+};
@@ -0,0 +1,915 @@
+// This code is released under the terms of the "CC0" license.  Full terms and conditions
+// can be found at: http://creativecommons.org/publicdomain/zero/1.0/
+
+#pragma once
+
+#include "DelegateTelemetry.h"
+#include "DelegateProfile.h"
+
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <cstddef>
+#include <cstring>
+#include <cassert>
+#include <atomic>
+
+// this is a simple delegate that supports functors of any signature, but never
+// ever allocates memory.  it uses a fixed-size buffer internally to be able to
+// support functors (and lambdas) of varying reasonable sizes to be stored
+// without copies.
+// goal is to find a reasonable size for this buffer that fits everything which
+// Real Code(tm) needs without wasting excess memory.  huge benefit for games where
+// memory allocation is bad.
+// naturally, this can all be achieved with std::function<> and a custom allocator,
+// but what fun is that?  ... actually that's totally the smarter option for "normal"
+// C++11 apps.  games typically replace half the STL anyway though, and a smaller
+// specialized delegate type will be faster to compile than std::function too.
+//
+// usage is similar to std::function, with the buffer size and alignment as
+// optional extra parameters:
+//
+//    delegate<void(entity&, float)> on_update;
+//    delegate<void(const event&), 64, 16> on_event; // bigger, SIMD-aligned captures
+//
+// Size is the maximum size of functors that can be stored in the delegate,
+// and Align the strictest alignment they may have.  the default size is not
+// (completely) random.  three pointers fits the common lambda capturing
+// this plus a couple of references or ints, and with the two pointers the
+// delegate keeps alongside the buffer it is a multiple of sizeof(double) on
+// both 32-bit and 64-bit platforms.  Size is rounded up to a multiple of both
+// Align and sizeof(void*), so the pointers after the buffer are never padded;
+// max_size is the rounded value.
+template <typename Signature, size_t Size = sizeof(void*) * 3, size_t Align = std::alignment_of<double>::value>
+struct delegate;
+
+template <typename Signature, size_t Size = sizeof(void*) * 3, size_t Align = std::alignment_of<double>::value>
+struct trivial_delegate;
+
+template <typename Signature, size_t Size = sizeof(void*) * 3, size_t Align = std::alignment_of<double>::value>
+struct unique_delegate;
+
+template <typename R, typename... Args, size_t Size, size_t Align>
+struct delegate<R(Args...), Size, Align>
+{
+	static_assert(Align > 0 && (Align & (Align - 1)) == 0, "Align must be a power of two");
+
+	// maximimum size and alignment of functors that can be stored in the
+	// delegate.
+	static const size_t alignment_unit = Align > sizeof(void*) ? Align : sizeof(void*);
+	static const size_t max_size = (Size + alignment_unit - 1) / alignment_unit * alignment_unit;
+	static const size_t max_alignment = Align;
+
+	// calls the functor stored at object.  arguments are taken by value
+	// type, exactly as declared in the signature, so references stay
+	// references and everything else is moved along once per hop; same deal
+	// as std::function.
+	typedef R (*invoke_function)(void* object, Args... args);
+
+	// the operations needed to copy, move and destroy the stored functor.
+	// there's one of these per functor type, in static constant storage,
+	// which is all that's left of the type after it is erased.  the invoke
+	// pointer is kept in the delegate itself instead of in here, so calling
+	// a delegate is one indirect call with no extra load of the table.
+	// copy_construct returns false if it couldn't make the copy, which only
+	// happens when a fallback allocator runs dry; the copy is left empty.
+	struct operations
+	{
+		bool (*copy_construct)(void* object, const void* source);
+		void (*move_construct)(void* object, void* source);
+		void (*destruct)(void* object);
+	};
+
+	union
+	{
+		// force alignment of our struct to Align; alignment of double,
+		// the strictest aligned type in standard C++, unless the delegate
+		// type asks for more (for SIMD captures, say).
+		typename std::aligned_storage<Align, Align>::type alignme;
+
+		// buffer in which we will store functors copied into the delegate.
+		// this must be big enough to store any functor you want to assign
+		// to the delegate.  if you get errors about functors being too
+		// big, you either need to increase this buffer size, or make your
+		// functors smaller (usually the latter).
+		char buffer[max_size];
+	};
+
+	// nullptr for the empty delegate.
+	invoke_function invoker;
+
+	// nullptr for trivially copyable functors (including everything bound
+	// with make_ref, which only stores a pointer), which are copied and
+	// moved by copying the buffer and need no destructor call.  that's most
+	// lambdas in practice, since capturing by value an int or a reference
+	// keeps a lambda trivially copyable.
+	const operations* ops;
+
+	// default constructor (most useful comment in the sample code)
+	delegate() : invoker(nullptr), ops(nullptr) {}
+
+	// constructor used by make and make_ref once they've picked the
+	// functions for the functor type; the functor is constructed into the
+	// buffer afterwards.  this shoudl ideally be private, but we're not
+	// keeping secrets from clients in this demo code.
+	delegate(invoke_function invoker, const operations* ops) : invoker(invoker), ops(ops) {}
+
+	// copy constructor, which needs to use our operations to ensure that
+	// functors are copied correctly.
+	delegate(const delegate& rhs) : invoker(rhs.invoker), ops(rhs.ops)
+	{
+		copy_from(rhs);
+	}
+
+	// move constructor, which needs to use our operations to ensure that
+	// functors are moved correctly.  leaves rhs empty.  noexcept, or
+	// std::vector would copy delegates instead of moving them when it
+	// grows; we don't support functors with throwing moves anyway.
+	delegate(delegate&& rhs) noexcept : invoker(rhs.invoker), ops(rhs.ops)
+	{
+		move_from(rhs);
+	}
+
+	// a trivial delegate converts to a regular one for free, since it only
+	// ever holds trivially copyable functors.
+	delegate(const trivial_delegate<R(Args...), Size, Align>& rhs) : invoker(rhs.invoker), ops(nullptr)
+	{
+		if (invoker != nullptr)
+			std::memcpy(buffer, rhs.buffer, max_size);
+	}
+
+	// destructor must be sure to invoke the destruct of the stored functor,
+	// since it might contain a std::unique_ptr or std::vector or something
+	// else that must be destructed properly.
+	~delegate()
+	{
+		if (ops != nullptr)
+			ops->destruct(buffer);
+	}
+
+	// copy assignment operator, which destroys our old functor if present
+	// and constructs a new one.  we do that since we can only use copy
+	// assignment on the functor objects if they're of identical type, which
+	// is rather unlikely (in this demo, at least); maybe it's worthwhile
+	// to test if the operations are equal (meaning the same functor type),
+	// but I lean away from extra dynamic branches in general.
+	delegate& operator=(const delegate& rhs)
+	{
+		if (this != &rhs)
+		{
+			// destroy current copy
+			if (ops != nullptr)
+				ops->destruct(buffer);
+
+			// get the new functions so we can operate on the incoming type
+			// all proper like, and copy incoming type, assuming we're not
+			// being assigned to the empty delegate.
+			invoker = rhs.invoker;
+			ops = rhs.ops;
+			copy_from(rhs);
+		}
+
+		return *this;
+	}
+
+	// move assignment operator.  note that we destruct the old functor
+	// we have, since we don't support bound assignment operators.
+	delegate& operator=(delegate&& rhs) noexcept
+	{
+		if (this != &rhs)
+		{
+			// destroy current copy
+			if (ops != nullptr)
+				ops->destruct(buffer);
+
+			// move incoming type, assuming we're not being assigned to
+			// the empty delegate.  the moved-from functor is destroyed
+			// right away and rhs is left empty, so there's only ever one
+			// live copy of whatever the functor owns.
+			invoker = rhs.invoker;
+			ops = rhs.ops;
+			move_from(rhs);
+		}
+
+		return *this;
+	}
+
+	// binds a functor to a delegate.  note that while this is set up to
+	// support move semantics, those don't actually work on lambdas.
+	template <typename Functor>
+	static delegate make(Functor&& functor DELEGATE_PROFILE_SITE_PARAMETER)
+	{
+		typedef typename std::decay<Functor>::type functor_type;
+		DELEGATE_TELEMETRY_BIND(delegate, functor_type, bind_inline);
+		DELEGATE_PROFILE_BIND(delegate, functor_type, bind_inline);
+
+		// checks to ensure that we're not trying to store an incompatible
+		// functor.  we have a fixed size for our buffer, and we don't support
+		// over-strict alignment.
+		static_assert(sizeof(functor_type) <= max_size, "Functor is too large for delegate; too many capture variables in lamba expression");
+		static_assert(std::alignment_of<functor_type>::value <= max_alignment, "Functor alignment is too strict for delegate");
+
+		static_assert(std::is_destructible<functor_type>::value, "Functor is not destructible; use make_ref instead if possible");
+		static_assert(std::is_copy_constructible<functor_type>::value, "Functor is not copy constructible; use make_ref instead if possible");
+
+		delegate result(&binding_value<functor_type>::invoke, binding_value<functor_type>::table());
+		new (result.buffer) functor_type(std::forward<Functor>(functor));
+		return result;
+	}
+
+	// binds a functor that may not fit in the buffer.  functors that fit are
+	// stored inline exactly like make(functor) does; bigger (or more
+	// strictly aligned) ones are placed in memory from the given allocator,
+	// and the buffer just holds a pointer to the functor and the allocator.
+	// never touches the global heap, unless the allocator does.
+	// an allocator is anything with these two members, the same shape as
+	// the slot map example's chunk allocators:
+	//
+	//    void* allocate(size_t size, size_t alignment);
+	//    void deallocate(void* ptr, size_t size, size_t alignment);
+	//
+	// it must outlive the delegate and all its copies, since copies allocate
+	// from it too.  returns the empty delegate if the allocator is out of
+	// memory.  every allocation bumps overflow_count(), so a quick look at
+	// that after a play session says whether Size is big enough.
+	template <typename Functor, typename Allocator>
+	static delegate make(Functor&& functor, Allocator& allocator DELEGATE_PROFILE_SITE_PARAMETER)
+	{
+		typedef typename std::decay<Functor>::type functor_type;
+		static const bool fits = sizeof(functor_type) <= max_size && std::alignment_of<functor_type>::value <= max_alignment;
+
+		return make_fallback(std::forward<Functor>(functor), allocator, std::integral_constant<bool, fits>() DELEGATE_PROFILE_SITE_ARGUMENT);
+	}
+
+	// number of functors that have been put in a fallback allocator instead
+	// of the buffer, by make(functor, allocator) or by copying a delegate
+	// made that way, across all delegates of this type.
+	static size_t overflow_count() { return overflow_counter().load(std::memory_order_relaxed); }
+
+	// binds a functor to a delegate, but as a reference/pointer.  this
+	// does not copy the functor.  this of course is a waste of space in
+	// our buffer, but sometimes you might need a single delegate instance
+	// that can store either a reference or a copy.
+	template <typename Functor>
+	static delegate make_ref(Functor&& functor DELEGATE_PROFILE_SITE_PARAMETER)
+	{
+		typedef typename std::remove_reference<Functor>::type functor_type;
+		DELEGATE_TELEMETRY_BIND(delegate, functor_type, bind_ref);
+		DELEGATE_PROFILE_BIND(delegate, functor_type, bind_ref);
+
+		delegate result(&binding_reference<functor_type>::invoke, nullptr);
+		new (result.buffer) functor_type*(&functor);
+		return result;
+	}
+
+	// binds a member function of an object, without a lambda in between:
+	//
+	//    auto on_click = delegate<void(int)>::bind<widget, &widget::clicked>(button);
+	//
+	// the buffer holds just the object pointer, so it's trivially copyable
+	// and needs no operations table, and the only code generated is one
+	// small thunk per member function, shared by every bind of it; a lambda
+	// capturing this gets its own thunk per lambda instead, even when they
+	// all call the same method.  the class has to be spelled out because
+	// C++11 can't deduce it from a member pointer template argument.  like
+	// make_ref, the object must outlive the delegate.
+	template <typename C, R (C::*Method)(Args...)>
+	static delegate bind(C& object)
+	{
+		DELEGATE_TELEMETRY_BIND(delegate, C*, bind_member);
+
+		delegate result(&binding_member<C, Method>::invoke, nullptr);
+		new (result.buffer) C*(&object);
+		return result;
+	}
+
+	template <typename C, R (C::*Method)(Args...) const>
+	static delegate bind(const C& object)
+	{
+		DELEGATE_TELEMETRY_BIND(delegate, const C*, bind_member);
+
+		delegate result(&binding_const_member<C, Method>::invoke, nullptr);
+		new (result.buffer) const C*(&object);
+		return result;
+	}
+
+	// binds a free function (or static member function) known at compile
+	// time:
+	//
+	//    auto on_quit = delegate<void()>::bind<&request_quit>();
+	//
+	// the buffer is left unused, and the thunk calls the function directly,
+	// so it can be inlined into it; a function pointer passed to make would
+	// be stored and called through, one more indirection.  see also
+	// trivial_delegate::bind for the constexpr version and static_delegate.
+	template <R (*Function)(Args...)>
+	static delegate bind()
+	{
+		return delegate(&binding_function<Function>::invoke, nullptr);
+	}
+
+	// public way to check if the delegate is empty (cannot be called) or
+	// or not.
+	bool empty() const { return invoker == nullptr; }
+
+	// if Visual Studio had full C++11, this would be a good operator to have.
+	// bool conversion operators without explicit conversion support are just
+	// a bad idea in my experience, though (that's why they added explicit
+	// conversion operators; I mean, not my experience specifically, but
+	// the world's shared C++ experience), so I'm avoiding it.
+	// explicit operator bool() const { return invoker == nullptr; }
+
+	// invoke our delegate.  does not check if the delegate is not bound.
+	// if you support exceptions, throw one, otherwise you should probably
+	// assert in debug builds at the very least.
+	// never call is empty() returns true.
+	template <typename... CallArgs>
+	R operator()(CallArgs&&... args)
+	{
+		return invoker(buffer, std::forward<CallArgs>(args)...);
+	}
+
+	// implementation of our bindings for standard functors/lambdas (copied
+	// into the delegate by value).
+	template <typename T>
+	struct binding_value
+	{
+		static R invoke(void* object, Args... args)
+		{
+			DELEGATE_PROFILE_INVOKE(delegate, T, bind_inline);
+			return (*static_cast<T*>(object))(std::forward<Args>(args)...);
+		}
+
+		static bool copy_construct(void* object, const void* source)
+		{
+			new (object) T(*static_cast<const T*>(source));
+			return true;
+		}
+
+		static void move_construct(void* object, void* source)
+		{
+			new (object) T(std::move(*static_cast<T*>(source)));
+		}
+
+		static void destruct(void* object)
+		{
+			static_cast<T*>(object)->~T();
+		}
+
+		// function-local so it needs no out-of-class definition; it's
+		// constant-initialized, so there's no guard check on access.
+		static const operations* table()
+		{
+			static const operations ops = { &copy_construct, &move_construct, &destruct };
+			return std::is_trivially_copyable<T>::value ? nullptr : &ops;
+		}
+
+		// for unique_delegate; never instantiates copy_construct, so T
+		// may be move-only.
+		static const operations* move_only_table()
+		{
+			static const operations ops = { nullptr, &move_construct, &destruct };
+			return std::is_trivially_copyable<T>::value ? nullptr : &ops;
+		}
+	};
+
+	// the same functor called through a const reference, for
+	// trivial_delegate's const operator(); only for functors whose call
+	// operator is const, so the buffer is never written.
+	template <typename T>
+	struct binding_const_value
+	{
+		static R invoke(void* object, Args... args)
+		{
+			DELEGATE_PROFILE_INVOKE(delegate, T, bind_inline);
+			return (*static_cast<const T*>(object))(std::forward<Args>(args)...);
+		}
+	};
+
+	// implementation of our bindings for functors/lambdas bound by reference.
+	// the buffer just holds a pointer, so there's nothing to do but call.
+	template <typename T>
+	struct binding_reference
+	{
+		static R invoke(void* object, Args... args)
+		{
+			DELEGATE_PROFILE_INVOKE(delegate, T, bind_ref);
+			return (**static_cast<T**>(object))(std::forward<Args>(args)...);
+		}
+	};
+
+	// implementation of our bindings for member functions.  the buffer holds
+	// the object pointer; the member function is a template argument, so
+	// the call is direct (or inlined) inside the thunk.
+	template <typename C, R (C::*Method)(Args...)>
+	struct binding_member
+	{
+		static R invoke(void* object, Args... args)
+		{
+			return ((*static_cast<C**>(object))->*Method)(std::forward<Args>(args)...);
+		}
+	};
+
+	template <typename C, R (C::*Method)(Args...) const>
+	struct binding_const_member
+	{
+		static R invoke(void* object, Args... args)
+		{
+			return ((*static_cast<const C**>(object))->*Method)(std::forward<Args>(args)...);
+		}
+	};
+
+	// free functions known at compile time.  nothing is stored at all; the
+	// function is a template argument, so the thunk calls it directly.
+	template <R (*Function)(Args...)>
+	struct binding_function
+	{
+		static R invoke(void*, Args... args)
+		{
+			return Function(std::forward<Args>(args)...);
+		}
+	};
+
+	// implementation of our bindings for functors too big for the buffer.
+	// the buffer holds a pointer to the functor and to the allocator it came
+	// from, and copies allocate their own copy of the functor from the same
+	// allocator.
+	template <typename T, typename Allocator>
+	struct binding_allocated
+	{
+		struct holder
+		{
+			T* functor;
+			Allocator* allocator;
+		};
+
+		// hands the memory back if the functor's constructor throws,
+		// unless it's been released.
+		struct allocation
+		{
+			Allocator& allocator;
+			void* memory;
+
+			~allocation()
+			{
+				if (memory != nullptr)
+					allocator.deallocate(memory, sizeof(T), std::alignment_of<T>::value);
+			}
+		};
+
+		// constructs the functor in memory from the allocator, or returns
+		// nullptr if the allocator is out of memory.
+		template <typename Source>
+		static T* create(Allocator& allocator, Source&& source)
+		{
+			allocation pending = { allocator, allocator.allocate(sizeof(T), std::alignment_of<T>::value) };
+			if (pending.memory == nullptr)
+				return nullptr;
+
+			T* functor = new (pending.memory) T(std::forward<Source>(source));
+			pending.memory = nullptr;
+			overflow_counter().fetch_add(1, std::memory_order_relaxed);
+			return functor;
+		}
+
+		static R invoke(void* object, Args... args)
+		{
+			DELEGATE_PROFILE_INVOKE(delegate, T, bind_fallback);
+			return (*static_cast<holder*>(object)->functor)(std::forward<Args>(args)...);
+		}
+
+		// if the allocator has run dry the copy comes out empty, the same
+		// as make does; there's no other way to report it from a copy
+		// constructor.
+		static bool copy_construct(void* object, const void* source)
+		{
+			const holder& from = *static_cast<const holder*>(source);
+			T* functor = create(*from.allocator, *from.functor);
+			if (functor == nullptr)
+				return false;
+
+			holder* to = new (object) holder(from);
+			to->functor = functor;
+			return true;
+		}
+
+		// moves just steal the pointer.
+		static void move_construct(void* object, void* source)
+		{
+			holder& from = *static_cast<holder*>(source);
+			new (object) holder(from);
+			from.functor = nullptr;
+		}
+
+		static void destruct(void* object)
+		{
+			holder& to = *static_cast<holder*>(object);
+			if (to.functor == nullptr)
+				return;
+
+			to.functor->~T();
+			to.allocator->deallocate(to.functor, sizeof(T), std::alignment_of<T>::value);
+		}
+
+		static const operations* table()
+		{
+			static const operations ops = { &copy_construct, &move_construct, &destruct };
+			return &ops;
+		}
+	};
+
+private:
+	static std::atomic<size_t>& overflow_counter()
+	{
+		static std::atomic<size_t> count(0);
+		return count;
+	}
+
+	template <typename Functor, typename Allocator>
+	static delegate make_fallback(Functor&& functor, Allocator&, std::true_type DELEGATE_PROFILE_SITE_PARAMETER)
+	{
+		return make(std::forward<Functor>(functor) DELEGATE_PROFILE_SITE_ARGUMENT);
+	}
+
+	template <typename Functor, typename Allocator>
+	static delegate make_fallback(Functor&& functor, Allocator& allocator, std::false_type DELEGATE_PROFILE_SITE_PARAMETER)
+	{
+		typedef typename std::decay<Functor>::type functor_type;
+		DELEGATE_TELEMETRY_BIND(delegate, functor_type, bind_fallback);
+		DELEGATE_PROFILE_BIND(delegate, functor_type, bind_fallback);
+		typedef binding_allocated<functor_type, Allocator> binding;
+
+		static_assert(sizeof(typename binding::holder) <= max_size, "Delegate buffer is too small to hold a fallback allocation");
+		static_assert(std::is_destructible<functor_type>::value, "Functor is not destructible; use make_ref instead if possible");
+		static_assert(std::is_copy_constructible<functor_type>::value, "Functor is not copy constructible; use make_ref instead if possible");
+
+		// the functor is constructed before the delegate is armed, so if
+		// its constructor throws there's no half-built delegate to destroy.
+		functor_type* allocated = binding::create(allocator, std::forward<Functor>(functor));
+		if (allocated == nullptr)
+			return delegate();
+
+		delegate result(&binding::invoke, binding::table());
+		typename binding::holder* held = new (result.buffer) typename binding::holder;
+		held->functor = allocated;
+		held->allocator = &allocator;
+		return result;
+	}
+
+	void copy_from(const delegate& rhs)
+	{
+		if (ops != nullptr)
+		{
+			if (!ops->copy_construct(buffer, rhs.buffer))
+			{
+				invoker = nullptr;
+				ops = nullptr;
+			}
+		}
+		else if (invoker != nullptr)
+			std::memcpy(buffer, rhs.buffer, max_size);
+	}
+
+	void move_from(delegate& rhs)
+	{
+		if (ops != nullptr)
+		{
+			ops->move_construct(buffer, rhs.buffer);
+			ops->destruct(rhs.buffer);
+		}
+		else if (invoker != nullptr)
+		{
+			std::memcpy(buffer, rhs.buffer, max_size);
+		}
+
+		rhs.invoker = nullptr;
+		rhs.ops = nullptr;
+	}
+};
+
+// move-only delegate, for functors that own something that can't be copied: a
+// lambda capturing a std::unique_ptr, a buffer handed off to a job, and so on.
+// same inline storage and operations as delegate, it just never copies, so
+// make() only needs a move constructible functor.  moving from it leaves it
+// empty.  a regular delegate can be moved into one, but not the other way.
+template <typename R, typename... Args, size_t Size, size_t Align>
+struct unique_delegate<R(Args...), Size, Align>
+{
+	typedef delegate<R(Args...), Size, Align> delegate_type;
+	typedef typename delegate_type::invoke_function invoke_function;
+	typedef typename delegate_type::operations operations;
+
+	static const size_t max_size = delegate_type::max_size;
+	static const size_t max_alignment = delegate_type::max_alignment;
+
+	union
+	{
+		typename std::aligned_storage<Align, Align>::type alignme;
+		char buffer[max_size];
+	};
+
+	// nullptr for the empty delegate.
+	invoke_function invoker;
+
+	// nullptr for trivially copyable functors, as in delegate; the
+	// copy_construct entry is never used.
+	const operations* ops;
+
+	unique_delegate() : invoker(nullptr), ops(nullptr) {}
+
+	unique_delegate(unique_delegate&& rhs) noexcept : invoker(rhs.invoker), ops(rhs.ops)
+	{
+		move_from(rhs.buffer, rhs.invoker, rhs.ops);
+	}
+
+	// takes over whatever a regular delegate holds.
+	unique_delegate(delegate_type&& rhs) noexcept : invoker(rhs.invoker), ops(rhs.ops)
+	{
+		move_from(rhs.buffer, rhs.invoker, rhs.ops);
+	}
+
+	unique_delegate(const unique_delegate&) = delete;
+	unique_delegate& operator=(const unique_delegate&) = delete;
+
+	~unique_delegate()
+	{
+		if (ops != nullptr)
+			ops->destruct(buffer);
+	}
+
+	unique_delegate& operator=(unique_delegate&& rhs) noexcept
+	{
+		if (this != &rhs)
+		{
+			if (ops != nullptr)
+				ops->destruct(buffer);
+
+			invoker = rhs.invoker;
+			ops = rhs.ops;
+			move_from(rhs.buffer, rhs.invoker, rhs.ops);
+		}
+
+		return *this;
+	}
+
+	template <typename Functor>
+	static unique_delegate make(Functor&& functor DELEGATE_PROFILE_SITE_PARAMETER)
+	{
+		typedef typename std::decay<Functor>::type functor_type;
+		DELEGATE_TELEMETRY_BIND(unique_delegate, functor_type, bind_inline);
+		DELEGATE_PROFILE_BIND(delegate_type, functor_type, bind_inline);
+
+		static_assert(sizeof(functor_type) <= max_size, "Functor is too large for delegate; too many capture variables in lamba expression");
+		static_assert(std::alignment_of<functor_type>::value <= max_alignment, "Functor alignment is too strict for delegate");
+
+		static_assert(std::is_destructible<functor_type>::value, "Functor is not destructible; use make_ref instead if possible");
+		static_assert(std::is_move_constructible<functor_type>::value, "Functor is not move constructible; use make_ref instead if possible");
+
+		unique_delegate result;
+		result.invoker = &delegate_type::template binding_value<functor_type>::invoke;
+		result.ops = delegate_type::template binding_value<functor_type>::move_only_table();
+		new (result.buffer) functor_type(std::forward<Functor>(functor));
+		return result;
+	}
+
+	template <typename Functor>
+	static unique_delegate make_ref(Functor&& functor DELEGATE_PROFILE_SITE_PARAMETER)
+	{
+		typedef typename std::remove_reference<Functor>::type functor_type;
+		DELEGATE_TELEMETRY_BIND(unique_delegate, functor_type, bind_ref);
+		DELEGATE_PROFILE_BIND(delegate_type, functor_type, bind_ref);
+
+		unique_delegate result;
+		result.invoker = &delegate_type::template binding_reference<functor_type>::invoke;
+		new (result.buffer) functor_type*(&functor);
+		return result;
+	}
+
+	bool empty() const { return invoker == nullptr; }
+
+	// never call is empty() returns true.
+	template <typename... CallArgs>
+	R operator()(CallArgs&&... args)
+	{
+		return invoker(buffer, std::forward<CallArgs>(args)...);
+	}
+
+private:
+	// the source is passed as its parts so this works for moving out of
+	// both unique_delegate and delegate.
+	void move_from(char* source, invoke_function& source_invoker, const operations*& source_ops)
+	{
+		if (ops != nullptr)
+		{
+			ops->move_construct(buffer, source);
+			ops->destruct(source);
+		}
+		else if (invoker != nullptr)
+		{
+			std::memcpy(buffer, source, max_size);
+		}
+
+		source_invoker = nullptr;
+		source_ops = nullptr;
+	}
+};
+
+// delegate restricted to trivially copyable functors, which makes the delegate
+// itself trivially copyable: copies, moves and destruction are all compiler
+// generated, so arrays of these can be memcpy'd around in bulk and
+// std::vector growth is a plain memmove.  captureless lambdas and lambdas
+// capturing only pointers, references or PODs all qualify, which covers most
+// event callbacks; anything else is a compile error on make, so nothing is
+// silently leaked by skipping its destructor.
+// same buffer layout as delegate, with a second invoker in place of the
+// operations pointer, for calling a const trivial_delegate.  that one calls
+// the functor as const, so functors without a const call operator (mutable
+// lambdas) can't be called through a const trivial_delegate.
+template <typename R, typename... Args, size_t Size, size_t Align>
+struct trivial_delegate<R(Args...), Size, Align>
+{
+	typedef delegate<R(Args...), Size, Align> delegate_type;
+	typedef typename delegate_type::invoke_function invoke_function;
+
+	static const size_t max_size = delegate_type::max_size;
+	static const size_t max_alignment = delegate_type::max_alignment;
+
+	union
+	{
+		typename std::aligned_storage<Align, Align>::type alignme;
+		char buffer[max_size];
+	};
+
+	// nullptr for the empty delegate.
+	invoke_function invoker;
+	// what operator() const calls; nullptr if the functor can only be called
+	// as non-const.
+	invoke_function const_invoker;
+
+	// a default constructor of our own is fine; only the copy, move and
+	// destructor members decide whether the type is trivially copyable.
+	// constexpr (both of them), so that empty and statically bound trivial
+	// delegates are literal values, and tables of them are constant
+	// initialized.
+	constexpr trivial_delegate() : alignme(), invoker(nullptr), const_invoker(nullptr) {}
+	explicit constexpr trivial_delegate(invoke_function invoker) : alignme(), invoker(invoker), const_invoker(invoker) {}
+
+	template <typename Functor>
+	static trivial_delegate make(Functor&& functor DELEGATE_PROFILE_SITE_PARAMETER)
+	{
+		typedef typename std::decay<Functor>::type functor_type;
+		DELEGATE_TELEMETRY_BIND(trivial_delegate, functor_type, bind_inline);
+		DELEGATE_PROFILE_BIND(delegate_type, functor_type, bind_inline);
+
+		static_assert(sizeof(functor_type) <= max_size, "Functor is too large for delegate; too many capture variables in lamba expression");
+		static_assert(std::alignment_of<functor_type>::value <= max_alignment, "Functor alignment is too strict for delegate");
+		static_assert(std::is_trivially_copyable<functor_type>::value, "Functor is not trivially copyable; use delegate instead");
+
+		trivial_delegate result;
+		result.invoker = &delegate_type::template binding_value<functor_type>::invoke;
+		result.const_invoker = const_invoker_for<functor_type>(typename is_const_callable<functor_type>::type());
+		new (result.buffer) functor_type(std::forward<Functor>(functor));
+		return result;
+	}
+
+	// binds by reference; a pointer is always trivially copyable, whatever
+	// it points to.
+	template <typename Functor>
+	static trivial_delegate make_ref(Functor&& functor DELEGATE_PROFILE_SITE_PARAMETER)
+	{
+		typedef typename std::remove_reference<Functor>::type functor_type;
+		DELEGATE_TELEMETRY_BIND(trivial_delegate, functor_type, bind_ref);
+		DELEGATE_PROFILE_BIND(delegate_type, functor_type, bind_ref);
+
+		trivial_delegate result;
+		result.invoker = &delegate_type::template binding_reference<functor_type>::invoke;
+		result.const_invoker = result.invoker;
+		new (result.buffer) functor_type*(&functor);
+		return result;
+	}
+
+	// member function binds, same as delegate::bind.
+	template <typename C, R (C::*Method)(Args...)>
+	static trivial_delegate bind(C& object)
+	{
+		DELEGATE_TELEMETRY_BIND(trivial_delegate, C*, bind_member);
+
+		trivial_delegate result;
+		result.invoker = &delegate_type::template binding_member<C, Method>::invoke;
+		result.const_invoker = result.invoker;
+		new (result.buffer) C*(&object);
+		return result;
+	}
+
+	template <typename C, R (C::*Method)(Args...) const>
+	static trivial_delegate bind(const C& object)
+	{
+		DELEGATE_TELEMETRY_BIND(trivial_delegate, const C*, bind_member);
+
+		trivial_delegate result;
+		result.invoker = &delegate_type::template binding_const_member<C, Method>::invoke;
+		result.const_invoker = result.invoker;
+		new (result.buffer) const C*(&object);
+		return result;
+	}
+
+	// free function binds, same as delegate::bind, but constexpr, so they
+	// can go straight into constant tables with no static initializers:
+	//
+	//    constexpr trivial_delegate<void(entity&)> handlers[] = {
+	//        trivial_delegate<void(entity&)>::bind<&on_spawn>(),
+	//        trivial_delegate<void(entity&)>::bind<&on_despawn>(),
+	//    };
+	//
+	// no telemetry for these, since there's nothing being stored.
+	template <R (*Function)(Args...)>
+	static constexpr trivial_delegate bind()
+	{
+		return trivial_delegate(&delegate_type::template binding_function<Function>::invoke);
+	}
+
+	constexpr bool empty() const { return invoker == nullptr; }
+
+	// never call is empty() returns true.
+	template <typename... CallArgs>
+	R operator()(CallArgs&&... args)
+	{
+		return invoker(buffer, std::forward<CallArgs>(args)...);
+	}
+
+	// for calling through constant tables.  unlike std::function, the
+	// functor is part of the object here, so it's called as const too; the
+	// cast only gets the buffer through invoke_function's signature, and
+	// nothing behind const_invoker writes to it.  reference and member
+	// binds only store a pointer, so whatever they point at is still called
+	// as bound.
+	template <typename... CallArgs>
+	R operator()(CallArgs&&... args) const
+	{
+		assert((empty() || const_invoker != nullptr) && "functor can't be called as const; call a non-const trivial_delegate");
+		return const_invoker(const_cast<char*>(buffer), std::forward<CallArgs>(args)...);
+	}
+
+private:
+	// whether a const Functor can be called with Args.
+	template <typename Functor>
+	struct is_const_callable
+	{
+		template <typename F, typename = decltype(std::declval<const F&>()(std::declval<Args>()...))>
+		static char test(int);
+		template <typename F>
+		static long test(...);
+
+		typedef std::integral_constant<bool, sizeof(test<Functor>(0)) == 1> type;
+	};
+
+	template <typename Functor>
+	static invoke_function const_invoker_for(std::true_type)
+	{
+		return &delegate_type::template binding_const_value<Functor>::invoke;
+	}
+
+	template <typename Functor>
+	static invoke_function const_invoker_for(std::false_type)
+	{
+		return nullptr;
+	}
+};
+
+// a free function bound at compile time, as a type of its own, with no state
+// and no type erasure at all: calling one is a direct call to Function that
+// the compiler can inline, so code that is templated on the callable (the
+// command buffer, multicast subscribe, algorithms) pays nothing for it.  it
+// converts to any delegate type of the right signature via bind, for when it
+// has to be stored in one after all.  C++11 can't deduce the signature from
+// a function pointer template argument, so it has to be spelled out:
+//
+//    static_delegate<void(int), &on_damage> handler;
+//    handler(10);  // direct call
+//    delegate<void(int)> stored = handler;  // one thunk away from on_damage
+template <typename Signature, Signature* Function>
+struct static_delegate;
+
+template <typename R, typename... Args, R (*Function)(Args...)>
+struct static_delegate<R(Args...), Function>
+{
+	constexpr static_delegate() {}
+
+	template <typename... CallArgs>
+	R operator()(CallArgs&&... args) const
+	{
+		return Function(std::forward<CallArgs>(args)...);
+	}
+
+	template <size_t Size, size_t Align>
+	operator delegate<R(Args...), Size, Align>() const
+	{
+		return delegate<R(Args...), Size, Align>::template bind<Function>();
+	}
+
+	template <size_t Size, size_t Align>
+	constexpr operator trivial_delegate<R(Args...), Size, Align>() const
+	{
+		return trivial_delegate<R(Args...), Size, Align>::template bind<Function>();
+	}
+};
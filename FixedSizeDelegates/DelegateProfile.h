@@ -0,0 +1,335 @@
+// This code is released under the terms of the "CC0" license.  Full terms and conditions
+// can be found at: http://creativecommons.org/publicdomain/zero/1.0/
+
+#pragma once
+
+// opt-in profiling of delegate calls, for when an event storm hits and every
+// frame in the profiler is the same anonymous delegate::operator().  define
+// DELEGATE_PROFILE for the whole build (same one-definition rule caveat as
+// DELEGATE_TELEMETRY, which it switches on too, since it borrows its type
+// names) and the invoke thunks of functors bound by value, by reference or
+// through a fallback allocator count their calls and the cycles spent in
+// them, per functor type, plus the file and line of the first make that
+// bound that type.  lambda types are unique per lambda expression, so for
+// lambdas that pins down the exact source line; functors bound through a
+// wrapper (multicast_delegate::subscribe, dispatch_table::bind) report the
+// line in the wrapper.  member and free function binds aren't instrumented;
+// what they call is already a named function in the profiler.
+// the counters are relaxed atomics in statically allocated records, so
+// there are no locks anywhere, and the records of delegate, trivial_delegate
+// and unique_delegate with the same signature and buffer are shared, since
+// those share their thunks.  the cycle counts are inclusive: a delegate
+// calling other delegates is charged for them too.
+// every call also lands in a fixed-size timeline of begin/end timestamps
+// (DELEGATE_PROFILE_EVENTS of them, the rest are dropped), which
+// write_chrome_trace turns into the JSON trace event format that
+// chrome://tracing, Perfetto and Tracy's import-chrome all read.
+// the totals are dumped to stderr at exit, hottest first.
+// without DELEGATE_PROFILE this header defines nothing but no-op macros,
+// and make and the thunks compile exactly as before.
+
+#if defined(DELEGATE_PROFILE)
+
+#include "DelegateTelemetry.h"
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if !defined(DELEGATE_PROFILE_EVENTS)
+#define DELEGATE_PROFILE_EVENTS 65536
+#endif
+
+// the caller's location, as a default argument of make and make_ref.  all
+// three compilers we care about have these builtins nowadays; older ones
+// just don't get a location.
+#if defined(__GNUC__) || defined(__clang__) || (defined(_MSC_VER) && _MSC_VER >= 1926)
+#define DELEGATE_PROFILE_HERE delegate_profile::site(__builtin_FILE(), static_cast<unsigned>(__builtin_LINE()))
+#else
+#define DELEGATE_PROFILE_HERE delegate_profile::site(nullptr, 0)
+#endif
+
+#define DELEGATE_PROFILE_SITE_PARAMETER , delegate_profile::site where = DELEGATE_PROFILE_HERE
+#define DELEGATE_PROFILE_SITE_ARGUMENT , where
+
+#define DELEGATE_PROFILE_BIND(Delegate, Functor, Kind) \
+	delegate_profile::entry<Delegate, Functor, delegate_telemetry::Kind>::bound(where)
+
+#define DELEGATE_PROFILE_INVOKE(Delegate, Functor, Kind) \
+	delegate_profile::timer delegate_profile_timer(delegate_profile::entry<Delegate, Functor, delegate_telemetry::Kind>::data)
+
+namespace delegate_profile
+{
+	struct site
+	{
+		const char* file;
+		unsigned line;
+
+		site(const char* file, unsigned line) : file(file), line(line) {}
+	};
+
+	// one per functor type and thunk kind.  constant-initialized, same as
+	// the telemetry records.
+	struct record
+	{
+		const char* (*functor_name)();
+		const char* (*delegate_name)();
+		const char* (*kind)();
+		std::atomic<const char*> file;
+		std::atomic<unsigned> line;
+		std::atomic<std::uint64_t> calls;
+		std::atomic<std::uint64_t> cycles;
+		record* next;
+
+		constexpr record(const char* (*functor_name)(), const char* (*delegate_name)(), const char* (*kind)())
+			: functor_name(functor_name), delegate_name(delegate_name), kind(kind)
+			, file(nullptr), line(0), calls(0), cycles(0), next(nullptr)
+		{}
+	};
+
+	// the cheapest timestamp there is: rdtsc on x86, which counts at a
+	// constant rate on anything made this decade, and the steady clock in
+	// nanoseconds elsewhere.
+	inline std::uint64_t ticks()
+	{
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+		return __rdtsc();
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+		return __builtin_ia32_rdtsc();
+#else
+		return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+	}
+
+	// when profiling started, in both ticks and wall time, so the timeline
+	// can be converted to microseconds without knowing the tick rate.
+	struct origin
+	{
+		std::uint64_t ticks;
+		std::chrono::steady_clock::time_point time;
+
+		origin() : ticks(delegate_profile::ticks()), time(std::chrono::steady_clock::now()) {}
+	};
+
+	inline const origin& start()
+	{
+		static const origin first;
+		return first;
+	}
+
+	struct event
+	{
+		const record* what;
+		std::uint64_t begin;
+		std::uint64_t end;
+		std::uint32_t thread;
+	};
+
+	// zero-initialized static storage; events past the end are dropped, but
+	// next keeps counting so the drops can be reported.
+	struct timeline
+	{
+		std::atomic<size_t> next;
+		event events[DELEGATE_PROFILE_EVENTS];
+	};
+
+	inline timeline& events()
+	{
+		static timeline all;
+		return all;
+	}
+
+	// small sequential thread numbers read better in a trace viewer than
+	// whatever the OS uses.
+	inline std::uint32_t thread_index()
+	{
+		static std::atomic<std::uint32_t> threads(0);
+		static thread_local std::uint32_t index = threads.fetch_add(1, std::memory_order_relaxed) + 1;
+		return index;
+	}
+
+	inline record*& head()
+	{
+		static record* first = nullptr;
+		return first;
+	}
+
+	// times one call for the record given, and logs it to the timeline.
+	class timer
+	{
+	public:
+		explicit timer(record& r) : profiled(r), begin(ticks()) {}
+
+		~timer()
+		{
+			std::uint64_t end = ticks();
+			profiled.calls.fetch_add(1, std::memory_order_relaxed);
+			profiled.cycles.fetch_add(end - begin, std::memory_order_relaxed);
+
+			timeline& log = events();
+			size_t slot = log.next.fetch_add(1, std::memory_order_relaxed);
+			if (slot < DELEGATE_PROFILE_EVENTS)
+			{
+				event& e = log.events[slot];
+				e.what = &profiled;
+				e.begin = begin;
+				e.end = end;
+				e.thread = thread_index();
+			}
+		}
+
+		timer(const timer&) = delete;
+		timer& operator=(const timer&) = delete;
+
+	private:
+		record& profiled;
+		std::uint64_t begin;
+	};
+
+	inline void dump(std::FILE* out)
+	{
+		std::vector<const record*> records;
+		for (const record* r = head(); r != nullptr; r = r->next)
+			if (r->calls.load(std::memory_order_relaxed) != 0)
+				records.push_back(r);
+
+		std::sort(records.begin(), records.end(), [](const record* a, const record* b) { return a->cycles.load(std::memory_order_relaxed) > b->cycles.load(std::memory_order_relaxed); });
+
+		std::fprintf(out, "delegate profile: %u functor types called\n", static_cast<unsigned>(records.size()));
+		std::fprintf(out, "  %12s %14s %10s  %-8s  %s\n", "calls", "cycles", "per call", "kind", "functor / bound at / delegate");
+		for (size_t i = 0; i < records.size(); ++i)
+		{
+			const record& r = *records[i];
+			unsigned long long calls = r.calls.load(std::memory_order_relaxed);
+			unsigned long long cycles = r.cycles.load(std::memory_order_relaxed);
+			const char* file = r.file.load(std::memory_order_relaxed);
+			std::fprintf(out, "  %12llu %14llu %10llu  %-8s  %s\n      at %s:%u\n      in %s\n",
+				calls, cycles, cycles / calls, r.kind(), r.functor_name(),
+				file != nullptr ? file : "?", r.line.load(std::memory_order_relaxed), r.delegate_name());
+		}
+
+		size_t logged = events().next.load(std::memory_order_relaxed);
+		if (logged > DELEGATE_PROFILE_EVENTS)
+			std::fprintf(out, "timeline full, %u calls not logged; raise DELEGATE_PROFILE_EVENTS\n", static_cast<unsigned>(logged - DELEGATE_PROFILE_EVENTS));
+	}
+
+	// writes the timeline as chrome trace events, one complete ("X") event
+	// per call.  call it while no delegates are being called, or the calls
+	// in flight may come out garbled.
+	inline void write_chrome_trace(std::FILE* out)
+	{
+		// ticks per microsecond, measured over the whole run so far.
+		const origin& from = start();
+		std::uint64_t now_ticks = ticks();
+		double elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - from.time).count();
+		double rate = elapsed > 0.0 ? static_cast<double>(now_ticks - from.ticks) / elapsed : 1.0;
+		if (rate <= 0.0)
+			rate = 1.0;
+
+		timeline& log = events();
+		size_t count = std::min<size_t>(log.next.load(std::memory_order_acquire), DELEGATE_PROFILE_EVENTS);
+
+		std::fprintf(out, "{\"traceEvents\":[");
+		bool first = true;
+		for (size_t i = 0; i < count; ++i)
+		{
+			// a slot claimed by a call that hasn't finished writing it.
+			const event& e = log.events[i];
+			if (e.what == nullptr)
+				continue;
+
+			std::fprintf(out, "%s\n{\"name\":\"", first ? "" : ",");
+			first = false;
+			// type names can have quotes in them (string literal template
+			// arguments, for one), and the odd backslash.
+			for (const char* c = e.what->functor_name(); *c != '\0'; ++c)
+			{
+				if (*c == '"' || *c == '\\')
+					std::fputc('\\', out);
+				std::fputc(*c, out);
+			}
+			std::fprintf(out, "\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+				e.what->kind(),
+				static_cast<double>(e.begin - from.ticks) / rate,
+				static_cast<double>(e.end - e.begin) / rate,
+				static_cast<unsigned>(e.thread));
+		}
+		std::fprintf(out, "\n],\"displayTimeUnit\":\"ns\"}\n");
+	}
+
+	// zeroes every counter and empties the timeline, to profile just one
+	// stretch of a run.  not safe while delegates are being called.
+	inline void reset()
+	{
+		for (record* r = head(); r != nullptr; r = r->next)
+		{
+			r->calls.store(0, std::memory_order_relaxed);
+			r->cycles.store(0, std::memory_order_relaxed);
+		}
+		events().next.store(0, std::memory_order_relaxed);
+	}
+
+	inline void dump_at_exit()
+	{
+		dump(stderr);
+	}
+
+	struct registration
+	{
+		explicit registration(record& r)
+		{
+			if (head() == nullptr)
+			{
+				start();
+				std::atexit(&dump_at_exit);
+			}
+
+			r.next = head();
+			head() = &r;
+		}
+	};
+
+	template <typename Delegate, typename Functor, typename Kind>
+	struct entry
+	{
+		static record data;
+		static registration registered;
+
+		// the first bind of a type wins; two threads binding it for the
+		// first time at once could mix one's file with the other's line,
+		// which is close enough for a profiler.
+		static void bound(const site& where)
+		{
+			(void)&registered;
+			if (where.file == nullptr || data.file.load(std::memory_order_relaxed) != nullptr)
+				return;
+
+			data.line.store(where.line, std::memory_order_relaxed);
+			data.file.store(where.file, std::memory_order_relaxed);
+		}
+	};
+
+	template <typename Delegate, typename Functor, typename Kind>
+	record entry<Delegate, Functor, Kind>::data(&delegate_telemetry::type_name<Functor>, &delegate_telemetry::type_name<Delegate>, &Kind::name);
+
+	template <typename Delegate, typename Functor, typename Kind>
+	registration entry<Delegate, Functor, Kind>::registered(entry<Delegate, Functor, Kind>::data);
+}
+
+#else
+
+#define DELEGATE_PROFILE_SITE_PARAMETER
+#define DELEGATE_PROFILE_SITE_ARGUMENT
+#define DELEGATE_PROFILE_BIND(Delegate, Functor, Kind) ((void)0)
+#define DELEGATE_PROFILE_INVOKE(Delegate, Functor, Kind) ((void)0)
+
+#endif
@@ -0,0 +1,238 @@
+// This code is released under the terms of the "CC0" license.  Full terms and conditions
+// can be found at: http://creativecommons.org/publicdomain/zero/1.0/
+
+#pragma once
+
+#include "Delegate.h"
+
+#include <atomic>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <cstddef>
+#include <cstdint>
+
+// bounded multi-producer, single-consumer queue of jobs, for worker threads
+// handing completions back to the main thread without a mutex and without
+// allocating per job.  every job is a unique_delegate stored inline in a
+// fixed-stride ring of cells, so it can hold anything delegate can (move-only
+// captures included) and a plain delegate can be pushed too.
+// this is Dmitry Vyukov's bounded queue: every cell carries a sequence number
+// saying whose turn it is.  a producer claims a cell with one compare-exchange
+// on the enqueue position, builds the job in place, and publishes it by
+// bumping the cell's sequence; the consumer owns the dequeue position outright,
+// so popping is a load and a store, no read-modify-write at all.  producers
+// never wait on each other beyond the compare-exchange retry, but a producer
+// that stalls between claiming and publishing holds up the consumer at that
+// cell (never the other producers), which is the usual price of this design.
+// capacity is rounded up to a power of two and allocated once up front.
+// try_push returns false when the queue is full, and leaves a delegate it was
+// given alone.
+//
+//    delegate_queue<void()> completions(1024);
+//    // on a worker:
+//    completions.try_push([result]() { apply(result); });
+//    // on the main thread, once a frame:
+//    completions.drain();
+template <typename Signature, size_t Size = sizeof(void*) * 3, size_t Align = std::alignment_of<double>::value>
+class delegate_queue;
+
+template <typename... Args, size_t Size, size_t Align>
+class delegate_queue<void(Args...), Size, Align>
+{
+public:
+	typedef unique_delegate<void(Args...), Size, Align> delegate_type;
+
+	explicit delegate_queue(size_t capacity)
+		: mask(round_up(capacity) - 1)
+		, memory(::operator new(sizeof(cell) * (mask + 1) + cell_alignment - 1))
+		, cells(align_cells(memory))
+		, enqueue_position(0)
+		, dequeue_position(0)
+	{
+		for (size_t i = 0; i <= mask; ++i)
+			new (&cells[i].sequence) std::atomic<size_t>(i);
+	}
+
+	// not thread-safe; all producers must be done with the queue.  jobs
+	// still queued are destroyed without being called.
+	~delegate_queue()
+	{
+		while (try_pop_with([](delegate_type&) {}))
+			;
+
+		for (size_t i = 0; i <= mask; ++i)
+			cells[i].sequence.~atomic();
+		::operator delete(memory);
+	}
+
+	delegate_queue(const delegate_queue&) = delete;
+	delegate_queue& operator=(const delegate_queue&) = delete;
+
+	// any thread.  binds the functor, same rules as unique_delegate::make.
+	// the job is built before a cell is claimed, so a functor whose copy
+	// throws can't leave a claimed cell that never gets published and
+	// stalls the consumer; the price is that a functor passed as an rvalue
+	// is moved from even when the queue turns out to be full.
+	template <typename Functor>
+	typename std::enable_if<!std::is_same<typename std::decay<Functor>::type, delegate_type>::value
+		&& !std::is_same<typename std::decay<Functor>::type, delegate<void(Args...), Size, Align> >::value, bool>::type try_push(Functor&& functor)
+	{
+		delegate_type job = delegate_type::make(std::forward<Functor>(functor));
+		return try_push(std::move(job));
+	}
+
+	// any thread.  the job is moved from only if there was room.
+	bool try_push(delegate_type&& job)
+	{
+		size_t position;
+		cell* c = claim(position);
+		if (c == nullptr)
+			return false;
+
+		new (c->job()) delegate_type(std::move(job));
+		publish(c, position);
+		return true;
+	}
+
+	bool try_push(delegate<void(Args...), Size, Align>&& job)
+	{
+		size_t position;
+		cell* c = claim(position);
+		if (c == nullptr)
+			return false;
+
+		new (c->job()) delegate_type(std::move(job));
+		publish(c, position);
+		return true;
+	}
+
+	// consumer thread only.  moves the oldest job out.
+	bool try_pop(delegate_type& job)
+	{
+		return try_pop_with([&job](delegate_type& queued) { job = std::move(queued); });
+	}
+
+	// consumer thread only.  calls every job that has been published so far,
+	// in order, and returns how many ran.  jobs pushed while draining may or
+	// may not be picked up.  arguments are passed on as lvalues, since
+	// there's more than one receiver.
+	template <typename... CallArgs>
+	size_t drain(CallArgs&&... args)
+	{
+		size_t count = 0;
+		while (try_pop_with([&](delegate_type& queued) { queued(args...); }))
+			++count;
+		return count;
+	}
+
+	// approximate while producers are pushing.
+	size_t size() const
+	{
+		size_t enqueued = enqueue_position.load(std::memory_order_relaxed);
+		size_t dequeued = dequeue_position.load(std::memory_order_relaxed);
+		return enqueued > dequeued ? enqueued - dequeued : 0;
+	}
+
+	bool empty() const { return size() == 0; }
+
+	size_t capacity() const { return mask + 1; }
+
+private:
+	// sequence == position: free for the producer claiming position.
+	// sequence == position + 1: holds the job pushed at position.
+	// the consumer frees a cell by setting it to position + capacity,
+	// which is when the producer a whole lap ahead gets its turn.
+	struct cell
+	{
+		std::atomic<size_t> sequence;
+		typename std::aligned_storage<sizeof(delegate_type), std::alignment_of<delegate_type>::value>::type storage;
+
+		delegate_type* job() { return reinterpret_cast<delegate_type*>(&storage); }
+	};
+
+	// keeps the producers' and the consumer's positions off each other's
+	// cache lines; placement, not alignment, so no over-aligned new needed.
+	static const size_t cache_line = 64;
+
+	// operator new only promises alignof(max_align_t), which is less than
+	// a delegate with a SIMD-sized Align needs (it's only 8 on MSVC), so
+	// the cells are aligned by hand inside a slightly bigger block.
+	static const size_t cell_alignment = std::alignment_of<cell>::value;
+
+	static cell* align_cells(void* memory)
+	{
+		std::uintptr_t address = reinterpret_cast<std::uintptr_t>(memory);
+		return reinterpret_cast<cell*>((address + cell_alignment - 1) & ~static_cast<std::uintptr_t>(cell_alignment - 1));
+	}
+
+	static size_t round_up(size_t capacity)
+	{
+		size_t rounded = 2;
+		while (rounded < capacity)
+			rounded *= 2;
+		return rounded;
+	}
+
+	cell* claim(size_t& position)
+	{
+		position = enqueue_position.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			cell* c = &cells[position & mask];
+			size_t sequence = c->sequence.load(std::memory_order_acquire);
+			std::ptrdiff_t lag = static_cast<std::ptrdiff_t>(sequence - position);
+			if (lag == 0)
+			{
+				// on failure this reloads position, so just go again.
+				if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					return c;
+			}
+			else if (lag < 0)
+			{
+				// the consumer hasn't freed this cell from the last lap.
+				return nullptr;
+			}
+			else
+			{
+				// someone claimed it first.
+				position = enqueue_position.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	void publish(cell* c, size_t position)
+	{
+		c->sequence.store(position + 1, std::memory_order_release);
+	}
+
+	template <typename Consume>
+	bool try_pop_with(Consume consume)
+	{
+		size_t position = dequeue_position.load(std::memory_order_relaxed);
+		cell* c = &cells[position & mask];
+		if (c->sequence.load(std::memory_order_acquire) != position + 1)
+			return false;
+
+		// free the cell before running the job, so the job itself is free
+		// to push into this queue even when it's full.
+		delegate_type job(std::move(*c->job()));
+		c->job()->~delegate_type();
+		c->sequence.store(position + mask + 1, std::memory_order_release);
+		dequeue_position.store(position + 1, std::memory_order_relaxed);
+
+		consume(job);
+		return true;
+	}
+
+	const size_t mask;
+	void* const memory;
+	cell* const cells;
+	char pad0[cache_line];
+	std::atomic<size_t> enqueue_position;
+	char pad1[cache_line - sizeof(std::atomic<size_t>)];
+	// atomic only so size() can read it from other threads; the consumer
+	// is the only writer.
+	std::atomic<size_t> dequeue_position;
+	char pad2[cache_line - sizeof(std::atomic<size_t>)];
+};
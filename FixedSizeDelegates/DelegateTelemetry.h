@@ -0,0 +1,198 @@
+// This code is released under the terms of the "CC0" license.  Full terms and conditions
+// can be found at: http://creativecommons.org/publicdomain/zero/1.0/
+
+#pragma once
+
+// opt-in instrumentation for finding out what Real Code(tm) actually binds to
+// delegates.  define DELEGATE_TELEMETRY for the whole build (it has to be the
+// same in every file, or the one-definition rule gets upset) and every make,
+// make_ref, bind and allocator fallback instantiation gets a record with the
+// functor type's size and alignment, the buffer size of the delegate type it
+// was bound to, and a count of how many times it was bound at runtime.
+// records register themselves during static initialization, so
+// instantiations that never ran still show up, with a count of zero.  at exit
+// the whole lot is dumped to stderr as a histogram of functor sizes plus the
+// full list, biggest first, which is what to look at for tuning Size per
+// delegate type or hunting down lambdas capturing half the world.
+// without DELEGATE_TELEMETRY this header defines nothing but a no-op macro.
+
+// DELEGATE_PROFILE (see DelegateProfile.h) builds on this, so it turns it
+// on as well.
+#if defined(DELEGATE_PROFILE) && !defined(DELEGATE_TELEMETRY)
+#define DELEGATE_TELEMETRY
+#endif
+
+#if defined(DELEGATE_TELEMETRY)
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+
+#define DELEGATE_TELEMETRY_BIND(Delegate, Functor, Kind) \
+	delegate_telemetry::entry<Delegate, Functor, delegate_telemetry::Kind>::bind()
+
+namespace delegate_telemetry
+{
+	// one per make/make_ref/fallback instantiation.  constant-initialized,
+	// so binds made from other static initializers are never lost.
+	struct record
+	{
+		const char* (*functor_name)();
+		const char* (*delegate_name)();
+		const char* (*kind)();
+		size_t functor_size;
+		size_t functor_alignment;
+		size_t buffer_size;
+		std::atomic<size_t> binds;
+		record* next;
+
+		constexpr record(const char* (*functor_name)(), const char* (*delegate_name)(), const char* (*kind)(), size_t functor_size, size_t functor_alignment, size_t buffer_size)
+			: functor_name(functor_name), delegate_name(delegate_name), kind(kind)
+			, functor_size(functor_size), functor_alignment(functor_alignment), buffer_size(buffer_size)
+			, binds(0), next(nullptr)
+		{}
+	};
+
+	struct bind_inline { static const char* name() { return "make"; } };
+	struct bind_ref { static const char* name() { return "make_ref"; } };
+	struct bind_fallback { static const char* name() { return "fallback"; } };
+	struct bind_member { static const char* name() { return "bind"; } };
+
+	// the name of T, without needing RTTI; trimmed out of the compiler's
+	// pretty function name, so the exact spelling varies by compiler.
+	template <typename T>
+	const char* type_name()
+	{
+#if defined(_MSC_VER)
+		static const char* const prefix = "type_name<";
+		static const char* const suffix = ">(void)";
+		const char* full = __FUNCSIG__;
+#else
+		static const char* const prefix = "T = ";
+		static const char* const suffix = "]";
+		const char* full = __PRETTY_FUNCTION__;
+#endif
+		static char name[256];
+		if (name[0] == '\0')
+		{
+			const char* begin = std::strstr(full, prefix);
+			begin = begin != nullptr ? begin + std::strlen(prefix) : full;
+			size_t length = std::strlen(begin);
+			size_t suffix_length = std::strlen(suffix);
+			if (length >= suffix_length && std::strcmp(begin + length - suffix_length, suffix) == 0)
+				length -= suffix_length;
+			if (length >= sizeof(name))
+				length = sizeof(name) - 1;
+			std::memcpy(name, begin, length);
+			name[length] = '\0';
+		}
+		return name;
+	}
+
+	// head of the list of all records.  a plain pointer, so it's
+	// constant-initialized before any record registers itself.
+	inline record*& head()
+	{
+		static record* first = nullptr;
+		return first;
+	}
+
+	inline void dump(std::FILE* out)
+	{
+		std::vector<const record*> records;
+		for (const record* r = head(); r != nullptr; r = r->next)
+			records.push_back(r);
+
+		std::sort(records.begin(), records.end(), [](const record* a, const record* b) { return a->functor_size > b->functor_size; });
+
+		// binds bucketed by functor size, in pointer-sized steps, which is
+		// the granularity Size gets rounded to anyway.
+		size_t largest = records.empty() ? 0 : records.front()->functor_size;
+		std::vector<size_t> buckets((largest + sizeof(void*) - 1) / sizeof(void*) + 1, 0);
+		size_t total = 0;
+		for (size_t i = 0; i < records.size(); ++i)
+		{
+			size_t binds = records[i]->binds.load(std::memory_order_relaxed);
+			buckets[(records[i]->functor_size + sizeof(void*) - 1) / sizeof(void*)] += binds;
+			total += binds;
+		}
+
+		std::fprintf(out, "delegate telemetry: %u bind sites, %u binds\n", static_cast<unsigned>(records.size()), static_cast<unsigned>(total));
+		std::fprintf(out, "functor size histogram (binds):\n");
+		for (size_t i = 0; i < buckets.size(); ++i)
+		{
+			if (buckets[i] == 0)
+				continue;
+
+			int bar = total == 0 ? 0 : static_cast<int>(buckets[i] * 60 / total);
+			std::fprintf(out, "  <= %4u bytes %10u  ", static_cast<unsigned>(i * sizeof(void*)), static_cast<unsigned>(buckets[i]));
+			for (int b = 0; b < bar; ++b)
+				std::fputc('#', out);
+			std::fputc('\n', out);
+		}
+
+		// anything bigger than its buffer is bound by reference or fell
+		// back to an allocator; those are the interesting ones.
+		std::fprintf(out, "bind sites, largest functor first:\n");
+		std::fprintf(out, "  %6s %5s %6s %10s  %-8s  %s\n", "size", "align", "buffer", "binds", "kind", "functor / delegate");
+		for (size_t i = 0; i < records.size(); ++i)
+		{
+			const record& r = *records[i];
+			std::fprintf(out, "  %6u %5u %6u %10u  %-8s  %s%s\n      in %s\n",
+				static_cast<unsigned>(r.functor_size), static_cast<unsigned>(r.functor_alignment), static_cast<unsigned>(r.buffer_size),
+				static_cast<unsigned>(r.binds.load(std::memory_order_relaxed)), r.kind(),
+				r.functor_name(), r.functor_size > r.buffer_size ? " (too big for buffer)" : "", r.delegate_name());
+		}
+	}
+
+	inline void dump_at_exit()
+	{
+		dump(stderr);
+	}
+
+	// links a record into the list during static initialization; the first
+	// one also arranges for the dump at exit.
+	struct registration
+	{
+		explicit registration(record& r)
+		{
+			if (head() == nullptr)
+				std::atexit(&dump_at_exit);
+
+			r.next = head();
+			head() = &r;
+		}
+	};
+
+	template <typename Delegate, typename Functor, typename Kind>
+	struct entry
+	{
+		static record data;
+		static registration registered;
+
+		static void bind()
+		{
+			// odr-using registered is what instantiates it, and with it
+			// the registration at startup.
+			(void)&registered;
+			data.binds.fetch_add(1, std::memory_order_relaxed);
+		}
+	};
+
+	template <typename Delegate, typename Functor, typename Kind>
+	record entry<Delegate, Functor, Kind>::data(&type_name<Functor>, &type_name<Delegate>, &Kind::name, sizeof(Functor), std::alignment_of<Functor>::value, Delegate::max_size);
+
+	template <typename Delegate, typename Functor, typename Kind>
+	registration entry<Delegate, Functor, Kind>::registered(entry<Delegate, Functor, Kind>::data);
+}
+
+#else
+
+#define DELEGATE_TELEMETRY_BIND(Delegate, Functor, Kind) ((void)0)
+
+#endif
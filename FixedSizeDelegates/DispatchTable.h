@@ -0,0 +1,303 @@
+// This code is released under the terms of the "CC0" license.  Full terms and conditions
+// can be found at: http://creativecommons.org/publicdomain/zero/1.0/
+
+#pragma once
+
+#include "Delegate.h"
+
+#include <algorithm>
+#include <utility>
+#include <type_traits>
+#include <cassert>
+#include <cstddef>
+
+namespace delegate_detail
+{
+	// the default fallback.  there's no default reference to return, so
+	// tables returning one have to be constructed with a fallback.
+	template <typename R, typename... Args>
+	struct dispatch_nothing
+	{
+		static_assert(!std::is_reference<R>::value, "dispatch tables returning a reference need an explicit fallback");
+
+		static R invoke(void*, Args...) { return R(); }
+	};
+}
+
+// handler tables keyed by an enum or small integer, for input bindings, state
+// machines, message handlers and the like, instead of a std::map<int,
+// delegate>; that's the v1 std::map from the slot map example all over
+// again, a tree walk and a cache miss per node on every dispatch.
+// dispatch_table is the dense version: one inline delegate per key value,
+// indexed directly, so dispatch is a bounds assert, a load and an indirect
+// call.  it suits keys that run 0..Count-1 with few holes, which is what
+// enums usually are.  handle_dispatch_table is the same thing for
+// per-object handlers keyed on a slot map handle; keying a dispatch_table on
+// the handle's index() would drop the generation, and a recycled slot would
+// get the old object's handler.  sparse_dispatch_table is the fallback for
+// keys that are all over the place: keys sorted in their own packed array,
+// so the binary search only touches keys, with the delegates in a parallel
+// array.  none of them allocate.
+// keys without a handler go to the fallback delegate, which by default does
+// nothing and returns a default constructed R.  tables returning a reference
+// have no such default, and take their fallback in the constructor.
+//
+//    enum state { idle, walking, jumping, state_count };
+//    dispatch_table<state, state(const input&), state_count> machine;
+//    machine.bind(idle, [](const input& in) { return in.move ? walking : idle; });
+//    current = machine.dispatch(current, in);
+template <typename Key, typename Signature, size_t Count, size_t Size = sizeof(void*) * 3, size_t Align = std::alignment_of<double>::value>
+class dispatch_table;
+
+template <typename Key, typename R, typename... Args, size_t Count, size_t Size, size_t Align>
+class dispatch_table<Key, R(Args...), Count, Size, Align>
+{
+public:
+	typedef delegate<R(Args...), Size, Align> delegate_type;
+
+	dispatch_table() : fallback(&delegate_detail::dispatch_nothing<R, Args...>::invoke, nullptr) {}
+
+	// must not be empty.
+	explicit dispatch_table(delegate_type handler) : fallback(std::move(handler))
+	{
+		assert(!fallback.empty());
+	}
+
+	// binds a functor, same rules as delegate::make, replacing whatever the
+	// key had before.
+	template <typename Functor>
+	typename std::enable_if<!std::is_same<typename std::decay<Functor>::type, delegate_type>::value>::type bind(Key key, Functor&& functor)
+	{
+		bind(key, delegate_type::make(std::forward<Functor>(functor)));
+	}
+
+	void bind(Key key, delegate_type handler)
+	{
+		handlers[index_of(key)] = std::move(handler);
+	}
+
+	void unbind(Key key)
+	{
+		handlers[index_of(key)] = delegate_type();
+	}
+
+	bool contains(Key key) const
+	{
+		return !handlers[index_of(key)].empty();
+	}
+
+	// what keys without a handler get; must not be empty.
+	void set_fallback(delegate_type handler)
+	{
+		assert(!handler.empty());
+		fallback = std::move(handler);
+	}
+
+	// calls the handler for key, or the fallback if there isn't one.
+	template <typename... CallArgs>
+	R dispatch(Key key, CallArgs&&... args)
+	{
+		delegate_type& handler = handlers[index_of(key)];
+		return handler.empty() ? fallback(std::forward<CallArgs>(args)...) : handler(std::forward<CallArgs>(args)...);
+	}
+
+private:
+	static size_t index_of(Key key)
+	{
+		size_t index = static_cast<size_t>(key);
+		assert(index < Count && "key out of range for dispatch_table");
+		return index;
+	}
+
+	delegate_type handlers[Count];
+	delegate_type fallback;
+};
+
+// dispatch_table keyed on a slot map style handle: anything with index() and
+// generation(), such as slot_handle.  the handler for a slot sits next to the
+// generation of the handle it was bound for, and dispatch only calls it if
+// the generations agree, so once the object is destroyed and its slot reused,
+// the old handle (and the new object, until something is bound for it) go to
+// the fallback instead of the old object's handler.  indices run 0..Count-1.
+//
+//    handle_dispatch_table<slot_map<enemy>::handle, void(float), 1024> on_hit;
+//    on_hit.bind(boss, [](float damage) { ... });
+//    on_hit.dispatch(target, 10.0f);
+template <typename Handle, typename Signature, size_t Count, size_t Size = sizeof(void*) * 3, size_t Align = std::alignment_of<double>::value>
+class handle_dispatch_table;
+
+template <typename Handle, typename R, typename... Args, size_t Count, size_t Size, size_t Align>
+class handle_dispatch_table<Handle, R(Args...), Count, Size, Align>
+{
+public:
+	typedef delegate<R(Args...), Size, Align> delegate_type;
+
+	handle_dispatch_table() : entries(), fallback(&delegate_detail::dispatch_nothing<R, Args...>::invoke, nullptr) {}
+
+	explicit handle_dispatch_table(delegate_type handler) : entries(), fallback(std::move(handler))
+	{
+		assert(!fallback.empty());
+	}
+
+	template <typename Functor>
+	typename std::enable_if<!std::is_same<typename std::decay<Functor>::type, delegate_type>::value>::type bind(Handle key, Functor&& functor)
+	{
+		bind(key, delegate_type::make(std::forward<Functor>(functor)));
+	}
+
+	// replaces whatever the slot had before, including a handler bound for
+	// an older generation.
+	void bind(Handle key, delegate_type handler)
+	{
+		entry& e = entries[index_of(key)];
+		e.generation = key.generation();
+		e.handler = std::move(handler);
+	}
+
+	// a stale handle leaves the slot's current handler alone.
+	void unbind(Handle key)
+	{
+		entry& e = entries[index_of(key)];
+		if (e.generation == key.generation())
+			e.handler = delegate_type();
+	}
+
+	bool contains(Handle key) const
+	{
+		const entry& e = entries[index_of(key)];
+		return e.generation == key.generation() && !e.handler.empty();
+	}
+
+	void set_fallback(delegate_type handler)
+	{
+		assert(!handler.empty());
+		fallback = std::move(handler);
+	}
+
+	// calls the handler bound for this exact handle, or the fallback if
+	// there isn't one or it was bound for another generation of the slot.
+	template <typename... CallArgs>
+	R dispatch(Handle key, CallArgs&&... args)
+	{
+		entry& e = entries[index_of(key)];
+		if (e.generation != key.generation() || e.handler.empty())
+			return fallback(std::forward<CallArgs>(args)...);
+		return e.handler(std::forward<CallArgs>(args)...);
+	}
+
+private:
+	struct entry
+	{
+		unsigned generation;
+		delegate_type handler;
+	};
+
+	static size_t index_of(Handle key)
+	{
+		size_t index = static_cast<size_t>(key.index());
+		assert(index < Count && "handle index out of range for handle_dispatch_table");
+		return index;
+	}
+
+	entry entries[Count];
+	delegate_type fallback;
+};
+
+// up to Capacity handlers for arbitrary keys, kept sorted.  binding and
+// unbinding shift the arrays around, so they're O(Capacity); dispatch is a
+// binary search, O(log size).  Key needs operator<.
+template <typename Key, typename Signature, size_t Capacity, size_t Size = sizeof(void*) * 3, size_t Align = std::alignment_of<double>::value>
+class sparse_dispatch_table;
+
+template <typename Key, typename R, typename... Args, size_t Capacity, size_t Size, size_t Align>
+class sparse_dispatch_table<Key, R(Args...), Capacity, Size, Align>
+{
+public:
+	typedef delegate<R(Args...), Size, Align> delegate_type;
+
+	sparse_dispatch_table() : keys(), fallback(&delegate_detail::dispatch_nothing<R, Args...>::invoke, nullptr), count(0) {}
+
+	explicit sparse_dispatch_table(delegate_type handler) : keys(), fallback(std::move(handler)), count(0)
+	{
+		assert(!fallback.empty());
+	}
+
+	template <typename Functor>
+	typename std::enable_if<!std::is_same<typename std::decay<Functor>::type, delegate_type>::value, bool>::type bind(Key key, Functor&& functor)
+	{
+		return bind(key, delegate_type::make(std::forward<Functor>(functor)));
+	}
+
+	// returns false, and binds nothing, if the key is new and the table is
+	// full.
+	bool bind(Key key, delegate_type handler)
+	{
+		size_t position = find(key);
+		if (position == count || key < keys[position])
+		{
+			if (count == Capacity)
+				return false;
+
+			for (size_t i = count; i > position; --i)
+			{
+				keys[i] = keys[i - 1];
+				handlers[i] = std::move(handlers[i - 1]);
+			}
+			keys[position] = key;
+			++count;
+		}
+
+		handlers[position] = std::move(handler);
+		return true;
+	}
+
+	void unbind(Key key)
+	{
+		size_t position = find(key);
+		if (position == count || key < keys[position])
+			return;
+
+		for (size_t i = position + 1; i < count; ++i)
+		{
+			keys[i - 1] = keys[i];
+			handlers[i - 1] = std::move(handlers[i]);
+		}
+		--count;
+		handlers[count] = delegate_type();
+	}
+
+	bool contains(Key key) const
+	{
+		size_t position = find(key);
+		return position != count && !(key < keys[position]);
+	}
+
+	void set_fallback(delegate_type handler)
+	{
+		assert(!handler.empty());
+		fallback = std::move(handler);
+	}
+
+	template <typename... CallArgs>
+	R dispatch(Key key, CallArgs&&... args)
+	{
+		size_t position = find(key);
+		if (position == count || key < keys[position])
+			return fallback(std::forward<CallArgs>(args)...);
+		return handlers[position](std::forward<CallArgs>(args)...);
+	}
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+
+private:
+	size_t find(Key key) const
+	{
+		return static_cast<size_t>(std::lower_bound(keys, keys + count, key) - keys);
+	}
+
+	Key keys[Capacity];
+	delegate_type handlers[Capacity];
+	delegate_type fallback;
+	size_t count;
+};
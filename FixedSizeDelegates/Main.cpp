@@ -3,6 +3,19 @@
 
 #include <iostream>
 #include <type_traits>
+#include <memory>
+#include <string>
+#include <vector>
+#include <thread>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+
+#include "Delegate.h"
+#include "MulticastDelegate.h"
+#include "CommandBuffer.h"
+#include "DelegateQueue.h"
+#include "DispatchTable.h"
 
 // for tests
 #define ASSERT_EQ(expected, actual) \
@@ -22,284 +35,11 @@
 		} \
 	} while(false)
 
-// this is a simple delegate that only supports functors with signature int(int),
-// but never ever allocates memory.  it uses a fixed-size buffer internally to be
-// able to support functors (and lambdas) of varying reasonable sizes to be stored
-// without copies.
-// goal is to find a reasonable size for this buffer that fits everything which
-// Real Code(tm) needs without wasting excess memory.  huge benefit for games where
-// memory allocation is bad.
-// naturally, this can all be achieved with std::function<> and a custom allocator,
-// but what fun is that?  ... actually that's totally the smarter option for "normal"
-// C++11 apps.  games typically replace half the STL anyway though, and a smaller
-// specialized delegate type will be faster to compile than std::function too.
-struct delegate
-{
-	// maximimum size of functors that can be stored in the delegate.
-	// size is not (completely) random.  chosen so that max_size + sizeof(void*)
-	// is evenly divisible by sizeof(double) on both 32-bit and 64-bit platforms.
-	// any odd scalar >= 3 is fine here.
-	// note that with a real implementation, this could be a template parameter
-	// with a default value, so you could control the size on a per-use basis.
-	// not doing that here as for demo purposes that's overkill.
-	static const size_t max_size = sizeof(void*) * 3;
-
-	// virtual base class for our binding, used to wrap up operations that must
-	// be performed on underlying types.  used for type erasure of those types.
-	// our use is technically a total hack, but works on all "real" systems we
-	// care about.  in particular, we use the this pointer and an offset to find
-	// the object we're operating on, since we don't use the this pointer for
-	// anything else, and it's going to be passed into this methods anyway.
-	struct binding_base
-	{
-		virtual int invoke(int) = 0;
-		virtual void copy_construct(const void* source) = 0;
-		virtual void move_construct(void* source) = 0;
-		virtual void destruct() = 0;
-	};
-
-	union
-	{
-		// force alignment of our struct to that of double, which is the
-		// strictest aligned type in standard C++.  not enough for SIMD
-		// types, but that's a larger problem in general.
-		double alignme;
-
-		// buffer in which we will store functors copied into the delegate.
-		// this must be big enough to store any functor you want to assign
-		// to the delegate.  if you get errors about functors being too
-		// big, you either need to increase this buffer size, or make your
-		// functors smaller (usually the latter).
-		char buffer[max_size];
-	};
-
-	// this is not actually a pointer to the binding class.  this actually
-	// _contains_ the binding class.  the idea is that the binding class is
-	// just a vtable pointer, which is just a pointer, and so can fit in a
-	// void*.  plus, copying the void* means copying the vtable pointer,
-	// which you can't normally do.  of course this is all completely
-	// implementation defined behavior, as there is no guarantee that
-	// virtual methods are even implemented with a virtual table of any
-	// kind... but for all our target compilers, this works.  i really
-	// wish there was a more well-defined way to do this, though.
-	void* binding;
-
-	// default constructor (most useful comment in the sample code)
-	delegate() : binding(nullptr) {}
-
-	// magic delegate constructor that can actually create all the necessary
-	// data given the right binding vtable.  this shoudl ideally be private,
-	// but we're not keeping secrets from clients in this demo code.
-	template <typename Functor>
-	delegate (void* binding_ptr, Functor&& functor) : binding(binding_ptr)
-	{
-		// determine whether we're moving or copying, based on whether we have
-		// a real rvalue reference or not.  remember, Functor&& in our
-		// signature doesn't mean rvalue reference, because the type is a
-		// templated type.  nah, C++ isn't confusing at all.
-		if (std::is_rvalue_reference<decltype(functor)>::value)
-			reinterpret_cast<binding_base*>(&binding)->move_construct(&functor);
-		else
-			reinterpret_cast<binding_base*>(&binding)->copy_construct(&functor);
-	}
-
-	// copy constructor, which needs to invoke our binding to ensure that
-	// functors are copied correctly.
-	delegate(const delegate& rhs) : binding(rhs.binding)
-	{
-		if (binding != nullptr)
-			reinterpret_cast<binding_base*>(&binding)->copy_construct(rhs.buffer);
-	}
-
-	// move constructor, which needs to invoke our binding to ensure that
-	// functors are moved correctly.
-	delegate(delegate&& rhs) : binding(rhs.binding)
-	{
-		if (binding != nullptr)
-			reinterpret_cast<binding_base*>(&binding)->move_construct(rhs.buffer);
-	}
-
-	// destructor must be sure to invoke the destruct of the stored functor,
-	// since it might contain a std::unique_ptr or std::vector or something
-	// else that must be destructed properly.
-	~delegate()
-	{
-		if (binding != nullptr)
-			reinterpret_cast<binding_base*>(&binding)->destruct();
-	}
-
-	// copy assignment operator, which destroys our old functor if present
-	// and constructs a new one.  we do that since we can only use copy
-	// assignment on the functor objects if they're of identical type, which
-	// is rather unlikely (in this demo, at least); maybe it's worthwhile
-	// to test if the bindings are equal (meaning the same functor type),
-	// but I lean away from extra dynamic branches in general.
-	delegate& operator=(const delegate& rhs)
-	{
-		if (this != &rhs)
-		{
-			// destroy current copy
-			if (binding != nullptr)
-				reinterpret_cast<binding_base*>(&binding)->destruct();
-
-			// get the new vtable so we can operate on the incoming type
-			// all proper like
-			binding = rhs.binding;
-
-			// copy incoming type, assuming we're not being assigned to
-			// the empty delegate.
-			if (binding != nullptr)
-				reinterpret_cast<binding_base*>(&binding)->copy_construct(rhs.buffer);
-		}
-
-		return *this;
-	}
-
-	// move assignment operator.  note that we destruct the old functor
-	// we have, since we don't support bound assignment operators.
-	delegate& operator=(delegate&& rhs)
-	{
-		if (this != &rhs)
-		{
-			// destroy current copy
-			if (binding != nullptr)
-				reinterpret_cast<binding_base*>(&binding)->destruct();
-
-			// get the new vtable so we can operate on the incoming type
-			// all proper like
-			binding = rhs.binding;
-
-			// copy incoming type, assuming we're not being assigned to
-			// the empty delegate.  destroy the moved-from delegate
-			// so it can clearly have its destructor called with no
-			// side-effects.  obviously would be better to support
-			// real move semantics here.
-			if (binding != nullptr)
-				reinterpret_cast<binding_base*>(&binding)->move_construct(rhs.buffer);
-		}
-
-		return *this;
-	}
-
-	// binds a functor to a delegate.  note that while this is set up to
-	// support move semantics, those don't actually work on lambdas.
-	template <typename Functor>
-	static delegate make(Functor&& functor)
-	{
-		// checks to ensure that we're not trying to store an incompatible
-		// functor.  we have a fixed size for our buffer, and we don't support
-		// over-strict alignment.
-		static_assert(sizeof(functor) <= max_size, "Functor is too large for delegate; too many capture variables in lamba expression");
-		static_assert(std::alignment_of<Functor>::value <= std::alignment_of<Functor>::value, "Functor alignment is too strict for delegate");
-
-		static_assert(std::is_destructible<Functor>::value, "Functor is not destructible; use make_ref instead if possible");
-		static_assert(std::is_copy_constructible<Functor>::value, "Functor is not copy constructible; use make_ref instead if possible");
-
-		// instantiate our magic binding class so that we can convert it
-		// into a void*.  we're basically casting its vtable pointer to
-		// a void*.  total hack.
-		void* binding;
-		static_assert(sizeof(binding_value<Functor>) == sizeof(binding), "Size of binding is not equal to size of pointer; compiler incompatible with fixed-size delegates");
-		new (&binding) binding_value<Functor>();
-
-		return delegate(binding, std::forward<Functor>(functor));
-	}
-
-	// binds a functor to a delegate, but as a reference/pointer.  this
-	// does not copy the functor.  this of course is a waste of space in
-	// our buffer, but sometimes you might need a single delegate instance
-	// that can store either a reference or a copy.
-	template <typename Functor>
-	static delegate make_ref(Functor&& functor)
-	{
-		// instantiate our magic binding class so that we can convert it
-		// into a void*.  we're basically casting its vtable pointer to
-		// a void*.  total hack.
-		void* binding;
-		static_assert(sizeof(binding_reference<Functor>) == sizeof(binding), "Size of binding is not equal to size of pointer; compiler incompatible with fixed-size delegates");
-		new (&binding) binding_reference<Functor>();
-
-		return delegate(binding, &functor);
-	}
-
-	// public way to check if the delegate is empty (cannot be called) or
-	// or not.
-	bool empty() const { return binding == nullptr; }
-
-	// if Visual Studio had full C++11, this would be a good operator to have.
-	// bool conversion operators without explicit conversion support are just
-	// a bad idea in my experience, though (that's why they added explicit
-	// conversion operators; I mean, not my experience specifically, but
-	// the world's shared C++ experience), so I'm avoiding it.
-	// explicit operator bool() const { return binding == nullptr; }
-
-	// invoke our delegate.  does not check if the delegate is not bound.
-	// if you support exceptions, throw one, otherwise you should probably
-	// assert in debug builds at the very least.
-	// never call is empty() returns true.
-	int operator()(int x)
-	{
-		return reinterpret_cast<binding_base*>(&binding)->invoke(x);
-	}
-
-	// implementation of our bindings for standard functors/lambdas (copied
-	// into the delegate by value).
-	template <typename T>
-	struct binding_value : public binding_base
-	{
-		virtual int invoke(int p)
-		{
-			return (*reinterpret_cast<T*>(reinterpret_cast<char*>(this) - delegate::max_size))(p);
-		}
-
-		virtual void copy_construct(const void* source)
-		{
-			new (reinterpret_cast<char*>(this) - delegate::max_size) T(*reinterpret_cast<const T*>(source));
-		}
-
-		virtual void move_construct(void* source)
-		{
-			new (reinterpret_cast<char*>(this) - delegate::max_size) T(std::move(*reinterpret_cast<T*>(source)));
-		}
-
-		virtual void destruct()
-		{
-			reinterpret_cast<T*>(reinterpret_cast<char*>(this) - delegate::max_size)->~T();
-		}
-	};
-
-	// implementation of our bindings for functors/lambdas bound by reference.
-	// mostly no-ops or simple copies of pointer values.
-	template <typename T>
-	struct binding_reference : public binding_base
-	{
-		virtual int invoke(int p)
-		{
-			return (**reinterpret_cast<T**>(reinterpret_cast<char*>(this) - delegate::max_size))(p);
-		}
-
-		virtual void copy_construct(const void* source)
-		{
-			*reinterpret_cast<T**>(reinterpret_cast<char*>(this) - delegate::max_size) = *reinterpret_cast<T* const*>(source);
-		}
-
-		virtual void move_construct(void* source)
-		{
-			*reinterpret_cast<T**>(reinterpret_cast<char*>(this) - delegate::max_size) = *reinterpret_cast<T* const*>(source);
-		}
-
-		virtual void destruct()
-		{
-			// no-op
-		}
-	};
-};
-
 // this struct is intentionally designed to be too big to fit
 // inside the buffer of the delegate.
 struct toobig
 {
-	char huge_buffer[delegate::max_size + 1];
+	char huge_buffer[delegate<int(int)>::max_size + 1];
 };
 
 // stats for side-effects class
@@ -341,11 +81,75 @@ struct Functor
 	int operator()(int x) { return x; }
 };
 
+// a functor that can only be moved, like a lambda with a unique_ptr capture
+// would be in C++14.
+struct MoveOnlyFunctor
+{
+	std::unique_ptr<int> value;
+
+	MoveOnlyFunctor(int x) : value(new int(x)) {}
+	MoveOnlyFunctor(MoveOnlyFunctor&& rhs) : value(std::move(rhs.value)) {}
+
+	int operator()(int x) { return x * *value; }
+};
+
+// bump allocator over a fixed block, standing in for a game's frame arena or
+// pool, that counts what it hands out.
+struct test_arena
+{
+	char memory[1024];
+	size_t used;
+	int live;
+
+	test_arena() : used(0), live(0) {}
+
+	void* allocate(size_t size, size_t alignment)
+	{
+		size_t start = (used + alignment - 1) & ~(alignment - 1);
+		if (start > sizeof(memory) || size > sizeof(memory) - start)
+			return nullptr;
+
+		used = start + size;
+		++live;
+		return memory + start;
+	}
+
+	void deallocate(void*, size_t, size_t) { --live; }
+};
+
+// something with callbacks to bind as member functions.
+struct counter
+{
+	int count;
+
+	counter() : count(0) {}
+
+	int add(int x) { count += x; return count; }
+	int scaled(int x) const { return x * count; }
+};
+
+// free functions for the compile-time binds.
+int triple(int x) { return x * 3; }
+int negate(int x) { return -x; }
+
+static int static_total = 0;
+void add_to_total(int x) { static_total += x; }
+
+// constant-initialized table of callbacks; no static initializers run.
+constexpr trivial_delegate<int(int)> static_table[] = {
+	trivial_delegate<int(int)>::bind<&triple>(),
+	trivial_delegate<int(int)>::bind<&negate>(),
+	static_delegate<int(int), &triple>(),
+	trivial_delegate<int(int)>(),
+};
+
+static_assert(static_table[3].empty(), "trivial delegates should be usable in constant expressions");
+
 // bunch of tests.  should be self-explanatory.
 void test1()
 {
-	auto d1 = delegate::make([](int x){ return x * x; });
-	auto d2 = delegate::make([](int x){ return x + 2 * x; });
+	auto d1 = delegate<int(int)>::make([](int x){ return x * x; });
+	auto d2 = delegate<int(int)>::make([](int x){ return x + 2 * x; });
 
 	ASSERT_EQ(25, d1(5));
 	ASSERT_EQ(15, d2(5));
@@ -356,7 +160,7 @@ void test2()
 	int x1 = 8;
 	int x2 = 12;
 
-	auto d3 = delegate::make([=](int x){ return x * x1 + x2; });
+	auto d3 = delegate<int(int)>::make([=](int x){ return x * x1 + x2; });
 
 	ASSERT_EQ(52, d3(5));
 }
@@ -366,7 +170,7 @@ void test3()
 	int x1 = 8;
 	int x2 = 12;
 
-	auto d3 = delegate::make([&](int x){ return x * x1 + x2; });
+	auto d3 = delegate<int(int)>::make([&](int x){ return x * x1 + x2; });
 
 	ASSERT_EQ(52, d3(5));
 
@@ -381,9 +185,9 @@ void test4()
 	toobig big;
 
 	// FAILS TO COMPILE: toobig make the lambda unable to fit inside delegate
-	//auto d4 = delegate::make([big](int x){ return x; });
+	//auto d4 = delegate<int(int)>::make([big](int x){ return x; });
 
-	auto d5 = delegate::make_ref([big](int x){ return x; });
+	auto d5 = delegate<int(int)>::make_ref([big](int x){ return x; });
 
 	ASSERT_EQ(5, d5(5));
 }
@@ -397,7 +201,7 @@ void test5()
 
 		ASSERT_EQ(1, stats.constructed);
 
-		auto d6 = delegate::make([fx](int x){ return x; });
+		auto d6 = delegate<int(int)>::make([fx](int x){ return x; });
 
 		ASSERT_EQ(2, stats.copied);
 		ASSERT_EQ(1, stats.destructed);
@@ -417,14 +221,14 @@ void test6()
 
 		ASSERT_EQ(1, stats.constructed);
 
-		auto d1 = delegate::make_ref([fx](int x){ return x; });
+		auto d1 = delegate<int(int)>::make_ref([fx](int x){ return x; });
 
 		ASSERT_EQ(1, stats.copied);
 		ASSERT_EQ(1, stats.destructed);
 
 		ASSERT_EQ(5, d1(5));
 
-		d1 = delegate::make([&fx](int x){ return x + 2 * x; });
+		d1 = delegate<int(int)>::make([&fx](int x){ return x + 2 * x; });
 
 		ASSERT_EQ(1, stats.copied);
 		ASSERT_EQ(1, stats.destructed);
@@ -440,7 +244,7 @@ void test7()
 	unit_stats stats;
 
 	{
-		auto d8 = delegate::make(Functor(stats));
+		auto d8 = delegate<int(int)>::make(Functor(stats));
 
 		ASSERT_EQ(1, stats.constructed);
 		ASSERT_EQ(1, stats.copied);
@@ -461,14 +265,14 @@ void test8()
 
 		ASSERT_EQ(1, stats.constructed);
 		
-		auto d1 = delegate::make([fx](int x){ return x + 2 * x; });
+		auto d1 = delegate<int(int)>::make([fx](int x){ return x + 2 * x; });
 
 		ASSERT_EQ(2, stats.copied);
 		ASSERT_EQ(1, stats.destructed);
 
 		ASSERT_EQ(15, d1(5));
 
-		d1 = delegate::make_ref([fx](int x){ return x; });
+		d1 = delegate<int(int)>::make_ref([fx](int x){ return x; });
 
 		ASSERT_EQ(3, stats.destructed);
 
@@ -478,6 +282,696 @@ void test8()
 	ASSERT_EQ(4, stats.destructed);
 }
 
+void test9()
+{
+	// other signatures; references pass straight through, and move-only
+	// arguments are forwarded rather than copied.
+	auto d1 = delegate<int(const std::string&, int)>::make([](const std::string& s, int x){ return static_cast<int>(s.size()) * x; });
+
+	ASSERT_EQ(15, d1(std::string("hello"), 3));
+
+	int total = 0;
+	auto d2 = delegate<void(int&, std::unique_ptr<int>)>::make([&total](int& out, std::unique_ptr<int> p){ out = *p; total += *p; });
+
+	int out = 0;
+	d2(out, std::unique_ptr<int>(new int(7)));
+
+	ASSERT_EQ(7, out);
+	ASSERT_EQ(7, total);
+
+	// bigger and more strictly aligned buffers on request.
+	toobig big;
+	big.huge_buffer[0] = 3;
+
+	typedef delegate<int(int), sizeof(toobig) + sizeof(void*), 16> big_delegate;
+	auto d3 = big_delegate::make([big](int x){ return x * big.huge_buffer[0]; });
+
+	ASSERT_EQ(15, d3(5));
+	ASSERT_EQ(true, big_delegate::max_size >= sizeof(toobig) + sizeof(void*));
+	ASSERT_EQ(0u, std::alignment_of<big_delegate>::value % 16);
+}
+
+void test10()
+{
+	unit_stats stats;
+
+	{
+		// trivially copyable functors don't get an operations table at
+		// all; copies are just a copy of the buffer.
+		int x1 = 8;
+		auto d1 = delegate<int(int)>::make([x1](int x){ return x * x1; });
+		auto d2 = d1;
+		delegate<int(int)> d3;
+		d3 = std::move(d2);
+
+		ASSERT_EQ(true, d1.ops == nullptr);
+		ASSERT_EQ(40, d3(5));
+
+		// everything else runs its constructors and destructor.
+		side_effects fx(stats);
+		auto d4 = delegate<int(int)>::make([fx](int x){ return x; });
+
+		ASSERT_EQ(false, d4.ops == nullptr);
+		ASSERT_EQ(2, stats.copied);
+
+		auto d5 = d4;
+		d3 = d5;
+
+		ASSERT_EQ(4, stats.copied);
+		ASSERT_EQ(1, stats.destructed);
+		ASSERT_EQ(5, d3(5));
+	}
+
+	ASSERT_EQ(5, stats.destructed);
+}
+
+void test11()
+{
+	typedef trivial_delegate<int(int)> trivial;
+
+	static_assert(std::is_trivially_copyable<trivial>::value, "trivial_delegate should be trivially copyable");
+
+	int x1 = 8;
+	int x2 = 12;
+
+	// bulk copies are just memcpy.
+	trivial source[2] = { trivial::make([](int x){ return x * x; }), trivial::make([&](int x){ return x * x1 + x2; }) };
+	trivial copies[2];
+	std::memcpy(copies, source, sizeof(source));
+
+	ASSERT_EQ(25, copies[0](5));
+	ASSERT_EQ(52, copies[1](5));
+
+	std::vector<trivial> queue;
+	for (int i = 0; i < 100; ++i)
+		queue.push_back(trivial::make([i](int x){ return x + i; }));
+
+	ASSERT_EQ(104, queue[99](5));
+
+	// a const one calls its functor as const.
+	const trivial fixed = trivial::make([x1, x2](int x){ return x * x1 + x2; });
+	ASSERT_EQ(52, fixed(5));
+
+	// and they convert to the full delegate for free.
+	delegate<int(int)> d1 = copies[1];
+
+	ASSERT_EQ(true, d1.ops == nullptr);
+	ASSERT_EQ(52, d1(5));
+}
+
+void test12()
+{
+	unit_stats stats;
+
+	{
+		multicast_delegate<void(int&), 2> signal;
+		int total = 0;
+
+		auto s1 = signal.subscribe([](int& x){ x += 1; });
+		auto s2 = signal.subscribe([](int& x){ x += 10; });
+		side_effects fx(stats);
+		auto s3 = signal.subscribe([fx](int& x){ x += 100; }); // past the inline storage
+
+		signal(total);
+
+		ASSERT_EQ(111, total);
+		ASSERT_EQ(3u, signal.size());
+
+		signal.unsubscribe(s2);
+		signal.unsubscribe(s2); // stale, no-op
+
+		ASSERT_EQ(false, signal.contains(s2));
+		ASSERT_EQ(true, signal.contains(s1));
+		ASSERT_EQ(true, signal.contains(s3));
+		ASSERT_EQ(false, signal.contains(0));
+
+		total = 0;
+		signal(total);
+
+		ASSERT_EQ(101, total);
+
+		// the freed slot is reused with a new generation.
+		auto s4 = signal.subscribe(delegate<void(int&)>::make([](int& x){ x += 1000; }));
+
+		ASSERT_EQ(true, signal.contains(s4));
+		ASSERT_EQ(false, signal.contains(s2));
+
+		// unsubscribing from inside a callback, both the running one and
+		// another one, is deferred until the invoke is done.
+		multicast_delegate<void(int&), 2>::subscription self = 0;
+		self = signal.subscribe([&](int& x){ x += 10000; signal.unsubscribe(self); signal.unsubscribe(s1); });
+
+		total = 0;
+		signal(total);
+
+		ASSERT_EQ(11101, total);
+		ASSERT_EQ(2u, signal.size());
+		ASSERT_EQ(false, signal.contains(self));
+
+		total = 0;
+		signal(total);
+
+		ASSERT_EQ(1100, total);
+
+		signal.clear();
+
+		ASSERT_EQ(true, signal.empty());
+		ASSERT_EQ(false, signal.contains(s3));
+	}
+
+	ASSERT_EQ(stats.constructed + stats.copied, stats.destructed);
+}
+
+void test13()
+{
+	unit_stats stats;
+
+	{
+		// move-only functors are stored inline.
+		auto d1 = unique_delegate<int(int)>::make(MoveOnlyFunctor(7));
+
+		ASSERT_EQ(35, d1(5));
+
+		auto d2 = std::move(d1);
+
+		ASSERT_EQ(true, d1.empty());
+		ASSERT_EQ(35, d2(5));
+
+		// regular delegates move into unique ones.
+		side_effects fx(stats);
+		unique_delegate<int(int)> d3 = delegate<int(int)>::make([fx](int x){ return x + 1; });
+
+		ASSERT_EQ(6, d3(5));
+
+		d2 = std::move(d3);
+
+		ASSERT_EQ(true, d3.empty());
+		ASSERT_EQ(6, d2(5));
+
+		// moving a delegate leaves the source empty, with its functor
+		// already destroyed.
+		auto d4 = delegate<int(int)>::make([fx](int x){ return x + 2; });
+		int live = stats.constructed + stats.copied - stats.destructed;
+		delegate<int(int)> d5;
+		d5 = std::move(d4);
+
+		ASSERT_EQ(true, d4.empty());
+		ASSERT_EQ(live, stats.constructed + stats.copied - stats.destructed);
+		ASSERT_EQ(7, d5(5));
+	}
+
+	ASSERT_EQ(stats.constructed + stats.copied, stats.destructed);
+}
+
+void test14()
+{
+	typedef delegate<int(int)> int_delegate;
+
+	unit_stats stats;
+	test_arena arena;
+	size_t overflows = int_delegate::overflow_count();
+
+	{
+		// small functors still go inline.
+		auto d1 = int_delegate::make([](int x){ return x * 2; }, arena);
+
+		ASSERT_EQ(10, d1(5));
+		ASSERT_EQ(0, arena.live);
+
+		// toobig doesn't fit, so it lands in the arena.
+		toobig big;
+		big.huge_buffer[0] = 3;
+		side_effects fx(stats);
+		auto d2 = int_delegate::make([big, fx](int x){ return x * big.huge_buffer[0]; }, arena);
+
+		ASSERT_EQ(15, d2(5));
+		ASSERT_EQ(1, arena.live);
+		ASSERT_EQ(overflows + 1, int_delegate::overflow_count());
+
+		// copies get their own allocation, moves steal it.
+		auto d3 = d2;
+		auto d4 = std::move(d2);
+
+		ASSERT_EQ(2, arena.live);
+		ASSERT_EQ(true, d2.empty());
+		ASSERT_EQ(15, d3(5));
+		ASSERT_EQ(15, d4(5));
+		ASSERT_EQ(overflows + 2, int_delegate::overflow_count());
+	}
+
+	ASSERT_EQ(0, arena.live);
+	ASSERT_EQ(stats.constructed + stats.copied, stats.destructed);
+
+	// an exhausted allocator gives the empty delegate.
+	struct huge { char bytes[2048]; } lots = {};
+	auto d5 = int_delegate::make([lots](int x){ return x + lots.bytes[0]; }, arena);
+
+	ASSERT_EQ(true, d5.empty());
+
+	// so does copying into an exhausted allocator.
+	test_arena small_arena;
+	struct large { char bytes[600]; } some = {};
+	auto d6 = int_delegate::make([some](int x){ return x + some.bytes[0]; }, small_arena);
+	auto d7 = d6;
+
+	ASSERT_EQ(false, d6.empty());
+	ASSERT_EQ(true, d7.empty());
+	ASSERT_EQ(1, small_arena.live);
+
+	// a functor whose constructor throws hands its memory back.
+	struct throwing
+	{
+		toobig big;
+		throwing() : big() {}
+		throwing(const throwing&) : big() { throw 1; }
+		int operator()(int x) const { return x; }
+	} thrower;
+	bool thrown = false;
+	try
+	{
+		int_delegate::make(thrower, small_arena);
+	}
+	catch (int)
+	{
+		thrown = true;
+	}
+
+	ASSERT_EQ(true, thrown);
+	ASSERT_EQ(1, small_arena.live);
+}
+
+void test15()
+{
+#if defined(DELEGATE_TELEMETRY)
+	// every bind site registered itself at startup; binding bumps only its
+	// own record.
+	auto bind = [](int x){ return x; };
+	typedef delegate_telemetry::entry<delegate<int(int)>, decltype(bind), delegate_telemetry::bind_inline> site;
+
+	size_t sites = 0;
+	for (delegate_telemetry::record* r = delegate_telemetry::head(); r != nullptr; r = r->next)
+		++sites;
+
+	ASSERT_EQ(true, sites >= 10);
+	ASSERT_EQ(0u, site::data.binds.load());
+
+	for (int i = 0; i < 3; ++i)
+		delegate<int(int)>::make(bind);
+
+	ASSERT_EQ(3u, site::data.binds.load());
+	ASSERT_EQ(sizeof(bind), site::data.functor_size);
+	ASSERT_EQ(delegate<int(int)>::max_size, site::data.buffer_size);
+#else
+	std::cout << "built without DELEGATE_TELEMETRY, nothing to test" << std::endl;
+#endif
+}
+
+void test16()
+{
+	counter c;
+
+	// member binds store just the object pointer.
+	auto d1 = delegate<int(int)>::bind<counter, &counter::add>(c);
+	auto d2 = delegate<int(int)>::bind<counter, &counter::scaled>(c);
+	auto d3 = trivial_delegate<int(int)>::bind<counter, &counter::add>(c);
+
+	ASSERT_EQ(true, d1.ops == nullptr);
+	ASSERT_EQ(5, d1(5));
+	ASSERT_EQ(10, d2(2));
+	ASSERT_EQ(8, d3(3));
+	ASSERT_EQ(8, c.count);
+
+	// binds of the same member function share one thunk.
+	counter other;
+	auto d4 = delegate<int(int)>::bind<counter, &counter::add>(other);
+
+	ASSERT_EQ(true, d1.invoker == d4.invoker);
+	ASSERT_EQ(false, d1.invoker == d2.invoker);
+	ASSERT_EQ(1, d4(1));
+	ASSERT_EQ(8, c.count);
+}
+
+void test17()
+{
+	unit_stats stats;
+
+	{
+		command_buffer<void(int&)> commands(256);
+		int total = 0;
+
+		side_effects fx(stats);
+		commands.push([](int& x){ x += 1; });
+		commands.push([fx](int& x){ x *= 10; });
+
+		// entries only take what they need, not a whole delegate each.
+		toobig big;
+		big.huge_buffer[0] = 5;
+		commands.push([big](int& x){ x += big.huge_buffer[0]; });
+
+		ASSERT_EQ(3u, commands.size());
+		ASSERT_EQ(true, commands.bytes_used() < 3 * sizeof(delegate<void(int&), sizeof(toobig)>));
+
+		// runs in order, destroying as it goes; commands may queue more.
+		commands.push([&commands](int& x){ x += 100; commands.push([](int& y){ y += 1000; }); });
+		commands.execute(total);
+
+		ASSERT_EQ(1115, total);
+		ASSERT_EQ(true, commands.empty());
+		ASSERT_EQ(0u, commands.bytes_used());
+		ASSERT_EQ(stats.constructed + stats.copied - 1, stats.destructed);
+
+		// full buffers refuse new commands.
+		int pushed = 0;
+		while (commands.push([big](int& x){ x += big.huge_buffer[0]; }))
+			++pushed;
+
+		ASSERT_EQ(true, pushed > 0 && pushed < 10);
+
+		// clear destroys without calling.
+		commands.clear();
+		commands.push([fx](int& x){ x = 0; });
+	}
+
+	ASSERT_EQ(stats.constructed + stats.copied, stats.destructed);
+}
+
+void test18()
+{
+	unit_stats stats;
+
+	{
+		delegate_queue<void(int&)> jobs(3);
+		ASSERT_EQ(4u, jobs.capacity());
+
+		// first in, first out, and full queues refuse jobs.
+		int total = 0;
+		side_effects fx(stats);
+		ASSERT_EQ(true, jobs.try_push([](int& x){ x += 1; }));
+		ASSERT_EQ(true, jobs.try_push([fx](int& x){ x *= 10; }));
+		ASSERT_EQ(true, jobs.try_push(delegate<void(int&)>::make([](int& x){ x += 5; })));
+		ASSERT_EQ(true, jobs.try_push([fx](int& x){ x *= 2; }));
+		ASSERT_EQ(false, jobs.try_push([fx](int& x){ x = 0; }));
+		ASSERT_EQ(4u, jobs.size());
+
+		delegate_queue<void(int&)>::delegate_type job;
+		ASSERT_EQ(true, jobs.try_pop(job));
+		job(total);
+		ASSERT_EQ(3u, jobs.drain(total));
+		ASSERT_EQ(30, total);
+		ASSERT_EQ(true, jobs.empty());
+		ASSERT_EQ(false, jobs.try_pop(job));
+
+		// move-only jobs, and leftovers get destroyed with the queue.
+		struct move_only_job
+		{
+			std::unique_ptr<int> value;
+			move_only_job(int x) : value(new int(x)) {}
+			move_only_job(move_only_job&& rhs) : value(std::move(rhs.value)) {}
+			void operator()(int& x) { x += *value; }
+		};
+
+		jobs.try_push(move_only_job(7));
+		ASSERT_EQ(true, jobs.try_pop(job));
+		job(total);
+		ASSERT_EQ(37, total);
+
+		// a job that throws while it's being bound mustn't leave a cell
+		// claimed and never published, or the consumer would wait on it
+		// forever.
+		struct throwing_job
+		{
+			throwing_job() {}
+			throwing_job(const throwing_job&) { throw 1; }
+			void operator()(int& x) const { x = -1; }
+		} thrower;
+		bool thrown = false;
+		try
+		{
+			jobs.try_push(thrower);
+		}
+		catch (int)
+		{
+			thrown = true;
+		}
+		ASSERT_EQ(true, thrown);
+		ASSERT_EQ(true, jobs.try_push([](int& x){ x += 1; }));
+		ASSERT_EQ(1u, jobs.drain(total));
+		ASSERT_EQ(38, total);
+
+		jobs.try_push(move_only_job(7));
+		jobs.try_push([fx](int& x){ x = 0; });
+	}
+
+	ASSERT_EQ(stats.constructed + stats.copied, stats.destructed);
+
+	// several producers against one consumer; every job has to arrive
+	// exactly once.
+	{
+		const int producers = 4;
+		const int per_producer = 20000;
+		delegate_queue<void(long long&)> jobs(64);
+
+		std::vector<std::thread> workers;
+		for (int t = 0; t < producers; ++t)
+		{
+			workers.push_back(std::thread([&jobs, t, per_producer]()
+			{
+				for (int i = 0; i < per_producer; ++i)
+				{
+					long long value = t * per_producer + i;
+					while (!jobs.try_push([value](long long& sum){ sum += value; }))
+						std::this_thread::yield();
+				}
+			}));
+		}
+
+		long long sum = 0;
+		long long expected = 0;
+		for (long long i = 0; i < producers * per_producer; ++i)
+			expected += i;
+
+		size_t received = 0;
+		while (received < static_cast<size_t>(producers * per_producer))
+			received += jobs.drain(sum);
+
+		for (size_t t = 0; t < workers.size(); ++t)
+			workers[t].join();
+
+		ASSERT_EQ(expected, sum);
+		ASSERT_EQ(true, jobs.empty());
+	}
+
+	// over-aligned delegates keep their alignment in the ring.
+	{
+		struct alignas(64) wide_job
+		{
+			float lanes[16];
+			void operator()(int& misaligned) { misaligned += reinterpret_cast<std::uintptr_t>(this) % 64 != 0 ? 1 : 0; }
+		};
+
+		delegate_queue<void(int&), 64, 64> jobs(8);
+		wide_job job = {};
+		for (int i = 0; i < 8; ++i)
+			jobs.try_push(job);
+
+		int misaligned = 0;
+		ASSERT_EQ(8u, jobs.drain(misaligned));
+		ASSERT_EQ(0, misaligned);
+	}
+}
+
+void test19()
+{
+	// free function binds, in every delegate type.
+	auto d1 = delegate<int(int)>::bind<&triple>();
+	auto d2 = trivial_delegate<int(int)>::bind<&negate>();
+	unique_delegate<int(int)> d3 = delegate<int(int)>::bind<&triple>();
+
+	ASSERT_EQ(true, d1.ops == nullptr);
+	ASSERT_EQ(15, d1(5));
+	ASSERT_EQ(-5, d2(5));
+	ASSERT_EQ(6, d3(2));
+
+	// the constant table, and calling through it.
+	ASSERT_EQ(12, static_table[0](4));
+	ASSERT_EQ(-4, static_table[1](4));
+	ASSERT_EQ(true, static_table[0].invoker == static_table[2].invoker);
+	ASSERT_EQ(true, static_table[0].invoker == d1.invoker);
+
+	// static_delegate calls directly, and converts when it has to be
+	// stored.
+	static_delegate<int(int), &negate> s1;
+	delegate<int(int)> stored = s1;
+	trivial_delegate<int(int), 32> stored_trivial = s1;
+
+	ASSERT_EQ(-7, s1(7));
+	ASSERT_EQ(-8, stored(8));
+	ASSERT_EQ(-9, stored_trivial(9));
+
+	// and goes into the templated containers with no erasure at all.
+	static_total = 0;
+	command_buffer<void(int)> commands(64);
+	commands.push(static_delegate<void(int), &add_to_total>());
+	commands.push(static_delegate<void(int), &add_to_total>());
+	commands.execute(4);
+
+	multicast_delegate<void(int)> event;
+	event.subscribe(static_delegate<void(int), &add_to_total>());
+	event(2);
+
+	ASSERT_EQ(10, static_total);
+}
+
+enum test_state { state_idle, state_walking, state_jumping, state_count };
+
+// stands in for a slot map handle: a slot index and the generation of the
+// object in it.
+struct test_handle
+{
+	unsigned slot;
+	unsigned age;
+
+	unsigned index() const { return slot; }
+	unsigned generation() const { return age; }
+};
+
+void test20()
+{
+	// a little state machine; every state decides the next one.
+	dispatch_table<test_state, test_state(int), state_count> machine;
+	machine.bind(state_idle, [](int input) { return input > 0 ? state_walking : state_idle; });
+	machine.bind(state_walking, [](int input) { return input > 1 ? state_jumping : input > 0 ? state_walking : state_idle; });
+
+	int inputs[] = { 0, 1, 1, 2, 0 };
+	test_state current = state_idle;
+	int jumps = 0;
+	for (int input : inputs)
+	{
+		current = machine.dispatch(current, input);
+		jumps += current == state_jumping;
+	}
+
+	// nothing's bound for jumping, so the default fallback returns
+	// state_idle, the default constructed value.
+	ASSERT_EQ(1, jumps);
+	ASSERT_EQ(state_idle, current);
+	ASSERT_EQ(false, machine.contains(state_jumping));
+
+	machine.set_fallback(delegate<test_state(int)>::make([](int) { return state_jumping; }));
+	ASSERT_EQ(state_jumping, machine.dispatch(state_jumping, 0));
+	machine.unbind(state_idle);
+	ASSERT_EQ(state_jumping, machine.dispatch(state_idle, 5));
+
+	// sparse keys, with a capturing handler and one that doesn't fit.
+	unit_stats stats;
+	{
+		int total = 0;
+		sparse_dispatch_table<int, void(int), 3> handlers;
+		side_effects fx(stats);
+
+		ASSERT_EQ(true, handlers.bind(1000, [&total](int x) { total += x; }));
+		ASSERT_EQ(true, handlers.bind(-7, [&total](int x) { total -= x; }));
+		ASSERT_EQ(true, handlers.bind(42, [fx, &total](int x) { total += x * 100; }));
+		ASSERT_EQ(false, handlers.bind(5, [&total](int x) { total += x; }));
+		ASSERT_EQ(true, handlers.bind(1000, [&total](int x) { total += x * 10; }));
+
+		handlers.dispatch(1000, 1);
+		handlers.dispatch(-7, 2);
+		handlers.dispatch(42, 3);
+		handlers.dispatch(5, 4);
+		ASSERT_EQ(308, total);
+
+		handlers.unbind(-7);
+		handlers.dispatch(-7, 2);
+		ASSERT_EQ(308, total);
+		ASSERT_EQ(2u, handlers.size());
+		ASSERT_EQ(true, handlers.contains(42));
+		ASSERT_EQ(false, handlers.contains(-7));
+	}
+
+	ASSERT_EQ(stats.constructed + stats.copied, stats.destructed);
+
+	// handlers returning a reference, with the fallback they need.
+	int slots[3] = { 0, 0, 0 };
+	int spare = 0;
+	dispatch_table<test_state, int&(), state_count> dense_slots(delegate<int&()>::make([&spare]() -> int& { return spare; }));
+	dense_slots.bind(state_walking, [&slots]() -> int& { return slots[1]; });
+	dense_slots.dispatch(state_walking) = 5;
+	dense_slots.dispatch(state_jumping) = 7;
+	sparse_dispatch_table<int, int&(), 2> sparse_slots(delegate<int&()>::make([&spare]() -> int& { return spare; }));
+	sparse_slots.bind(99, [&slots]() -> int& { return slots[2]; });
+	sparse_slots.dispatch(99) += 3;
+	sparse_slots.dispatch(1) += 1;
+	ASSERT_EQ(5, slots[1]);
+	ASSERT_EQ(3, slots[2]);
+	ASSERT_EQ(8, spare);
+
+	// per-object handlers; a handle for a recycled slot mustn't reach the
+	// handler bound for the slot's previous object.
+	handle_dispatch_table<test_handle, int(int), 4> per_object(delegate<int(int)>::make([](int) { return -1; }));
+	test_handle first = { 2, 1 };
+	test_handle reused = { 2, 2 };
+	per_object.bind(first, [](int x) { return x * 2; });
+	ASSERT_EQ(10, per_object.dispatch(first, 5));
+	ASSERT_EQ(-1, per_object.dispatch(reused, 5));
+	ASSERT_EQ(false, per_object.contains(reused));
+	per_object.bind(reused, [](int x) { return x * 3; });
+	ASSERT_EQ(-1, per_object.dispatch(first, 5));
+	per_object.unbind(first);
+	ASSERT_EQ(15, per_object.dispatch(reused, 5));
+	per_object.unbind(reused);
+	ASSERT_EQ(-1, per_object.dispatch(reused, 5));
+}
+
+void test21()
+{
+#if defined(DELEGATE_PROFILE)
+	// calls are counted per functor type, whichever delegate flavour they
+	// went through, and the type remembers where it was first bound.
+	int total = 0;
+	auto add = [&total](int x) { total += x; return total; };
+	typedef delegate_profile::entry<delegate<int(int)>, decltype(add), delegate_telemetry::bind_inline> value_site;
+	typedef delegate_profile::entry<delegate<int(int)>, decltype(add), delegate_telemetry::bind_ref> ref_site;
+
+	unsigned line = __LINE__ + 1;
+	auto d1 = delegate<int(int)>::make(add);
+	auto d2 = trivial_delegate<int(int)>::make(add);
+	auto d3 = delegate<int(int)>::make_ref(add);
+
+	for (int i = 0; i < 3; ++i)
+		d1(1);
+	d2(1);
+	d3(1);
+
+	ASSERT_EQ(5, total);
+	ASSERT_EQ(4u, value_site::data.calls.load());
+	ASSERT_EQ(1u, ref_site::data.calls.load());
+	ASSERT_EQ(line, value_site::data.line.load());
+	ASSERT_EQ(line + 2, ref_site::data.line.load());
+	ASSERT_EQ(true, std::strstr(value_site::data.file.load(), "Main.cpp") != nullptr);
+
+	// the timeline comes out as chrome trace events.
+	std::FILE* trace = std::tmpfile();
+	delegate_profile::write_chrome_trace(trace);
+	std::string json;
+	std::rewind(trace);
+	for (int c = std::fgetc(trace); c != EOF; c = std::fgetc(trace))
+		json += static_cast<char>(c);
+	std::fclose(trace);
+
+	ASSERT_EQ(0u, json.find("{\"traceEvents\":["));
+	ASSERT_EQ(true, json.find("\"ph\":\"X\"") != std::string::npos);
+
+	// reset starts over.
+	delegate_profile::reset();
+	ASSERT_EQ(0u, value_site::data.calls.load());
+	d1(1);
+	ASSERT_EQ(1u, value_site::data.calls.load());
+#else
+	std::cout << "built without DELEGATE_PROFILE, nothing to test" << std::endl;
+#endif
+}
+
 void(*tests[])() = {
 	&test1,
 	&test2,
@@ -487,6 +981,19 @@ void(*tests[])() = {
 	&test6,
 	&test7,
 	&test8,
+	&test9,
+	&test10,
+	&test11,
+	&test12,
+	&test13,
+	&test14,
+	&test15,
+	&test16,
+	&test17,
+	&test18,
+	&test19,
+	&test20,
+	&test21,
 	nullptr
 };
 
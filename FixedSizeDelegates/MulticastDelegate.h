@@ -0,0 +1,315 @@
+// This code is released under the terms of the "CC0" license.  Full terms and conditions
+// can be found at: http://creativecommons.org/publicdomain/zero/1.0/
+
+#pragma once
+
+#include "Delegate.h"
+
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <cassert>
+#include <cstddef>
+
+namespace delegate_detail
+{
+	// vector with inline storage for the first N elements, and one contiguous
+	// heap block once it outgrows that.  just enough of std::vector for the
+	// multicast delegate; elements must have a non-throwing move.
+	template <typename T, size_t N>
+	class small_vector
+	{
+		static_assert(N > 0, "small_vector needs room for at least one inline element");
+
+	public:
+		small_vector() : items(inline_items()), count(0), capacity(N) {}
+
+		~small_vector()
+		{
+			clear();
+			if (items != inline_items())
+				::operator delete(items);
+		}
+
+		small_vector(const small_vector&) = delete;
+		small_vector& operator=(const small_vector&) = delete;
+
+		void push_back(const T& value)
+		{
+			if (count == capacity)
+				grow();
+			new (items + count) T(value);
+			++count;
+		}
+
+		void push_back(T&& value)
+		{
+			if (count == capacity)
+				grow();
+			new (items + count) T(std::move(value));
+			++count;
+		}
+
+		// makes room for at least wanted elements, so that pushing up to
+		// that many can't throw.
+		void reserve(size_t wanted)
+		{
+			while (capacity < wanted)
+				grow();
+		}
+
+		void pop_back()
+		{
+			--count;
+			items[count].~T();
+		}
+
+		void clear()
+		{
+			while (count != 0)
+				pop_back();
+		}
+
+		T& operator[](size_t index) { return items[index]; }
+		const T& operator[](size_t index) const { return items[index]; }
+
+		T& back() { return items[count - 1]; }
+
+		T* data() { return items; }
+		size_t size() const { return count; }
+
+	private:
+		T* inline_items() { return reinterpret_cast<T*>(&storage); }
+
+		void grow()
+		{
+			T* grown = static_cast<T*>(::operator new(sizeof(T) * capacity * 2));
+			for (size_t i = 0; i < count; ++i)
+			{
+				new (grown + i) T(std::move(items[i]));
+				items[i].~T();
+			}
+
+			if (items != inline_items())
+				::operator delete(items);
+			items = grown;
+			capacity *= 2;
+		}
+
+		typename std::aligned_storage<sizeof(T) * N, std::alignment_of<T>::value>::type storage;
+		T* items;
+		size_t count;
+		size_t capacity;
+	};
+}
+
+// a signal: any number of delegates that are all invoked together.  the first
+// InlineCount subscribers live inside the multicast delegate itself, so most
+// events never allocate at all; past that they move to one contiguous heap
+// block.  subscribers are kept packed (unsubscribing swaps the last one into
+// the hole), and their invoke pointers are kept in their own packed array, so
+// raising the event is a tight loop of indirect calls.
+// subscriptions are handles in the style of v4::object_id from the slot map
+// example: slot index in the low 32 bits, generation in the high 32 bits, and
+// the slot only matches while the generations agree.  unsubscribe is O(1), and
+// unsubscribing twice, or with a handle from a long-gone subscriber, is a
+// harmless no-op.  generations start at 1, so a zero subscription never
+// matches anything and makes a good "not subscribed" value.
+// subscribers may unsubscribe (themselves or others) from inside a callback;
+// removal is deferred until the outermost invoke returns, and removed
+// subscribers are not called again in the meantime.  subscribing from inside
+// a callback is not supported, since growing could move the delegate that is
+// currently running.
+template <typename Signature, size_t InlineCount = 4, size_t Size = sizeof(void*) * 3, size_t Align = std::alignment_of<double>::value>
+class multicast_delegate;
+
+template <typename... Args, size_t InlineCount, size_t Size, size_t Align>
+class multicast_delegate<void(Args...), InlineCount, Size, Align>
+{
+public:
+	typedef delegate<void(Args...), Size, Align> delegate_type;
+	typedef typename delegate_type::invoke_function invoke_function;
+	typedef unsigned long long subscription;
+
+	multicast_delegate() : free_head(empty_index), invoking(0), removed(0) {}
+
+	multicast_delegate(const multicast_delegate&) = delete;
+	multicast_delegate& operator=(const multicast_delegate&) = delete;
+
+	// binds a functor, same rules as delegate::make.
+	template <typename Functor>
+	typename std::enable_if<!std::is_same<typename std::decay<Functor>::type, delegate_type>::value, subscription>::type subscribe(Functor&& functor)
+	{
+		return subscribe(delegate_type::make(std::forward<Functor>(functor)));
+	}
+
+	// adds an already bound delegate.  subscribing the empty delegate is
+	// not allowed.
+	subscription subscribe(delegate_type target)
+	{
+		assert(invoking == 0 && "can't subscribe from inside a callback");
+		assert(!target.empty());
+
+		if (free_head == empty_index)
+		{
+			free_head = static_cast<unsigned>(slots.size());
+			slot s = { 1, empty_index };
+			slots.push_back(s);
+		}
+
+		// all three arrays are grown before the slot comes off the free
+		// list, so running out of memory leaves them in step and the slot
+		// still free.  after that nothing can throw.
+		invokers.reserve(invokers.size() + 1);
+		targets.reserve(targets.size() + 1);
+		owners.reserve(owners.size() + 1);
+
+		unsigned index = free_head;
+		slot& s = slots[index];
+		free_head = s.position;
+		s.position = static_cast<unsigned>(targets.size());
+
+		invokers.push_back(target.invoker);
+		targets.push_back(std::move(target));
+		owners.push_back(index);
+		return make_subscription(index, s.generation);
+	}
+
+	// O(1) via the slot table.  stale handles are ignored.
+	void unsubscribe(subscription id)
+	{
+		unsigned index = static_cast<unsigned>(id & 0xFFFFFFFF);
+		if (!contains(id))
+			return;
+
+		unsigned position = slots[index].position;
+		release(index);
+
+		if (invoking != 0)
+		{
+			// the delegate might be the one that's running, so only
+			// disarm it now and let the outermost invoke sweep it up.
+			invokers[position] = &skip;
+			owners[position] = empty_index;
+			++removed;
+		}
+		else
+		{
+			erase(position);
+		}
+	}
+
+	bool contains(subscription id) const
+	{
+		unsigned index = static_cast<unsigned>(id & 0xFFFFFFFF);
+		return index < slots.size() && slots[index].generation == static_cast<unsigned>(id >> 32);
+	}
+
+	// calls every subscriber, in no particular order.  arguments are passed
+	// on as lvalues, since there's more than one receiver.
+	template <typename... CallArgs>
+	void operator()(CallArgs&&... args)
+	{
+		++invoking;
+
+		size_t count = invokers.size();
+		invoke_function* calls = invokers.data();
+		delegate_type* bound = targets.data();
+		for (size_t i = 0; i < count; ++i)
+			calls[i](bound[i].buffer, args...);
+
+		if (--invoking == 0 && removed != 0)
+			sweep();
+	}
+
+	size_t size() const { return invokers.size() - removed; }
+	bool empty() const { return size() == 0; }
+
+	// drops every subscriber.  all outstanding subscriptions go stale.
+	void clear()
+	{
+		assert(invoking == 0 && "can't clear from inside a callback");
+
+		for (size_t i = 0; i < owners.size(); ++i)
+		{
+			unsigned index = owners[i];
+			if (index == empty_index)
+				continue;
+
+			release(index);
+		}
+
+		invokers.clear();
+		targets.clear();
+		owners.clear();
+		removed = 0;
+	}
+
+private:
+	static const unsigned empty_index = 0xFFFFFFFF;
+
+	// position of the subscriber in the packed arrays while subscribed, next
+	// free slot while free.
+	struct slot
+	{
+		unsigned generation;
+		unsigned position;
+	};
+
+	static subscription make_subscription(unsigned index, unsigned generation)
+	{
+		return static_cast<subscription>(index) | (static_cast<subscription>(generation) << 32);
+	}
+
+	static void skip(void*, Args...) {}
+
+	// bumps the generation, which is what makes old subscriptions stale,
+	// and puts the slot on the free list.  zero is skipped on wrap-around
+	// to keep it meaning "not subscribed".
+	void release(unsigned index)
+	{
+		slot& s = slots[index];
+		if (++s.generation == 0)
+			s.generation = 1;
+		s.position = free_head;
+		free_head = index;
+	}
+
+	// swap-and-pop of the subscriber at position, in all three arrays.
+	void erase(unsigned position)
+	{
+		unsigned last = static_cast<unsigned>(invokers.size() - 1);
+		if (position != last)
+		{
+			invokers[position] = invokers[last];
+			targets[position] = std::move(targets[last]);
+			owners[position] = owners[last];
+			if (owners[position] != empty_index)
+				slots[owners[position]].position = position;
+		}
+
+		invokers.pop_back();
+		targets.pop_back();
+		owners.pop_back();
+	}
+
+	// removes everything that was unsubscribed during an invoke.  walking
+	// backwards means whatever erase swaps in has already been looked at.
+	void sweep()
+	{
+		for (size_t i = owners.size(); i-- > 0; )
+		{
+			if (owners[i] == empty_index)
+				erase(static_cast<unsigned>(i));
+		}
+		removed = 0;
+	}
+
+	delegate_detail::small_vector<invoke_function, InlineCount> invokers;
+	delegate_detail::small_vector<delegate_type, InlineCount> targets;
+	delegate_detail::small_vector<unsigned, InlineCount> owners;
+	delegate_detail::small_vector<slot, InlineCount> slots;
+	unsigned free_head;
+	unsigned invoking;
+	size_t removed;
+};
@@ -0,0 +1,522 @@
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__linux__)
+#	include <linux/perf_event.h>
+#	include <sys/ioctl.h>
+#	include <sys/syscall.h>
+#	include <unistd.h>
+#endif
+
+#include "../SlotMapExample/ObjectTables.h"
+#include "../SlotMapExample/SlotMap.h"
+#include "../SlotMapExample/DenseSlotMap.h"
+#include "../SlotMapExample/SoaSlotMap.h"
+#include "../SlotMapExample/ConcurrentSlotMap.h"
+
+// micro-benchmarks for the slot map strategies.  for every strategy, size,
+// and access pattern this runs create, get on live handles, full iteration,
+// destroy, and get on the just-destroyed (stale) handles, and reports ns per
+// operation, plus hardware cache misses per operation where the OS lets us
+// read them (perf events on Linux; nowhere else yet).
+// usage: SlotMapBenchmark [max_objects]
+// max_objects caps the 1K/100K/10M sizes, for quick runs.  build in Release;
+// the numbers from a debug build are meaningless.
+
+// hardware cache-miss counter.  silently unavailable if the CPU, VM, or
+// kernel settings don't allow it, in which case read() returns -1.
+struct cache_miss_counter
+{
+#if defined(__linux__)
+	int fd;
+
+	cache_miss_counter()
+	{
+		perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = PERF_COUNT_HW_CACHE_MISSES;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+	}
+
+	~cache_miss_counter() { if (fd != -1) close(fd); }
+
+	bool available() const { return fd != -1; }
+
+	void start()
+	{
+		if (fd == -1)
+			return;
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+
+	long long stop()
+	{
+		if (fd == -1)
+			return -1;
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		long long count = 0;
+		return read(fd, &count, sizeof(count)) == sizeof(count) ? count : -1;
+	}
+#else
+	bool available() const { return false; }
+	void start() {}
+	long long stop() { return -1; }
+#endif
+};
+
+// accumulated time and misses for one operation.
+struct measurement
+{
+	double nanoseconds;
+	long long misses;
+	long long operations;
+
+	measurement() : nanoseconds(0), misses(0), operations(0) {}
+};
+
+// everything gets folded into this and printed at the end, so that the
+// compiler can't throw away lookups and iteration whose results are unused.
+static long long checksum = 0;
+
+typedef std::chrono::steady_clock bench_clock;
+
+template <typename Body>
+void measure(measurement& m, cache_miss_counter& counter, long long operations, Body body)
+{
+	counter.start();
+	bench_clock::time_point begin = bench_clock::now();
+	body();
+	bench_clock::time_point end = bench_clock::now();
+	long long misses = counter.stop();
+
+	m.nanoseconds += std::chrono::duration<double, std::nano>(end - begin).count();
+	m.misses = (misses < 0 || m.misses < 0) ? -1 : m.misses + misses;
+	m.operations += operations;
+}
+
+// adaptors giving every strategy the same interface.  iterate() visits every
+// live object and returns a sum over them; strategies that can't enumerate
+// their live objects at all set can_iterate to false.
+
+struct v1_strategy
+{
+	typedef int handle;
+	static const char* name() { return "v1 std::map"; }
+	static const bool can_iterate = true;
+
+	~v1_strategy() { v1::reset(); }
+	handle create() { return v1::create_object(); }
+	bool get(handle id) { return v1::get_object(id) != nullptr; }
+	void destroy(handle id) { v1::destroy_object(id); }
+
+	long long iterate()
+	{
+		long long sum = 0;
+		for (std::map<int, v1::object>::iterator iter = v1::object_table.begin(); iter != v1::object_table.end(); ++iter)
+			sum += iter->second.id;
+		return sum;
+	}
+};
+
+struct v2_strategy
+{
+	typedef int handle;
+	static const char* name() { return "v2 vector"; }
+	static const bool can_iterate = true;
+
+	~v2_strategy() { v2::reset(); }
+	handle create() { return v2::create_object(); }
+	bool get(handle id) { return v2::get_object(id) != nullptr; }
+	void destroy(handle id) { v2::destroy_object(id); }
+
+	long long iterate()
+	{
+		long long sum = 0;
+		for (size_t i = 0; i < v2::object_table.size(); ++i)
+			if (v2::object_table[i].id != -1)
+				sum += v2::object_table[i].id;
+		return sum;
+	}
+};
+
+struct v3_strategy
+{
+	typedef int handle;
+	static const char* name() { return "v3 chunks"; }
+	static const bool can_iterate = true;
+
+	~v3_strategy() { v3::reset(); }
+	handle create() { return v3::create_object(); }
+	bool get(handle id) { return v3::get_object(id) != nullptr; }
+	void destroy(handle id) { v3::destroy_object(id); }
+
+	long long iterate()
+	{
+		long long sum = 0;
+		for (size_t c = 0; c < v3::object_table.size(); ++c)
+			for (size_t i = 0; i < v3::chunk_size; ++i)
+				if (v3::object_table[c][i].id != -1)
+					sum += v3::object_table[c][i].id;
+		return sum;
+	}
+};
+
+// v4 and v5 free slots look exactly like live ones (they hold the handle
+// they'll hand out next), so the best iteration can do is visit every slot.
+struct v4_strategy
+{
+	typedef v4::object_id handle;
+	static const char* name() { return "v4 slot map"; }
+	static const bool can_iterate = true;
+
+	~v4_strategy() { v4::reset(); }
+	handle create() { return v4::create_object(); }
+	bool get(handle id) { return v4::get_object(id) != nullptr; }
+	void destroy(handle id) { v4::destroy_object(id); }
+
+	long long iterate()
+	{
+		long long sum = 0;
+		for (size_t c = 0; c < v4::object_table.size(); ++c)
+			for (size_t i = 0; i < v4::chunk_size; ++i)
+				sum += v4::object_table[c][i].id;
+		return sum;
+	}
+};
+
+struct v5_strategy
+{
+	typedef v5::object_id handle;
+	static const char* name() { return "v5 intrusive"; }
+	static const bool can_iterate = true;
+
+	~v5_strategy() { v5::reset(); }
+	handle create() { return v5::create_object(); }
+	bool get(handle id) { return v5::get_object(id) != nullptr; }
+	void destroy(handle id) { v5::destroy_object(id); }
+
+	long long iterate()
+	{
+		long long sum = 0;
+		for (size_t c = 0; c < v5::object_table.size(); ++c)
+			for (size_t i = 0; i < v5::chunk_size; ++i)
+				sum += v5::object_table[c][i].id;
+		return sum;
+	}
+};
+
+struct slot_map_strategy
+{
+	typedef slot_map<int>::handle handle;
+	static const char* name() { return "slot_map"; }
+	static const bool can_iterate = true;
+
+	slot_map<int> map;
+	int next;
+
+	slot_map_strategy() : next(0) {}
+	handle create() { return map.create(next++); }
+	bool get(handle id) { return map.get(id) != nullptr; }
+	void destroy(handle id) { map.destroy(id); }
+
+	long long iterate()
+	{
+		long long sum = 0;
+		map.for_each([&sum](int value) { sum += value; });
+		return sum;
+	}
+};
+
+// same map with the handles split out from the payloads in every chunk.  an
+// int payload is the worst case for the extra line get hit touches, and get
+// stale shows what validation from a compact handle array buys.
+struct split_slot_map_strategy
+{
+	typedef slot_map<int, 256, handle_layout<>, heap_chunk_allocator, split_slots<> > map_type;
+	typedef map_type::handle handle;
+	static const char* name() { return "slot_map split"; }
+	static const bool can_iterate = true;
+
+	map_type map;
+	int next;
+
+	split_slot_map_strategy() : next(0) {}
+	handle create() { return map.create(next++); }
+	bool get(handle id) { return map.get(id) != nullptr; }
+	void destroy(handle id) { map.destroy(id); }
+
+	long long iterate()
+	{
+		long long sum = 0;
+		map.for_each([&sum](int value) { sum += value; });
+		return sum;
+	}
+};
+
+// same map through create_n/get_n/destroy_n.  lookups go through a small
+// scratch array of pointers, the way a caller would use get_n, so the
+// results stay in L1 instead of streaming out to a second big array.
+struct slot_map_batch_strategy : slot_map_strategy
+{
+	static const char* name() { return "slot_map batch"; }
+
+	static const size_t lookup_batch = 256;
+	int* pointers[lookup_batch];
+};
+
+struct dense_strategy
+{
+	typedef dense_slot_map<int>::handle handle;
+	static const char* name() { return "dense_slot_map"; }
+	static const bool can_iterate = true;
+
+	dense_slot_map<int> map;
+	int next;
+
+	dense_strategy() : next(0) {}
+	handle create() { return map.create(next++); }
+	bool get(handle id) { return map.get(id) != nullptr; }
+	void destroy(handle id) { map.destroy(id); }
+
+	long long iterate()
+	{
+		long long sum = 0;
+		for (dense_slot_map<int>::iterator iter = map.begin(); iter != map.end(); ++iter)
+			sum += *iter;
+		return sum;
+	}
+};
+
+struct soa_strategy
+{
+	typedef soa_slot_map<int, float>::handle handle;
+	static const char* name() { return "soa_slot_map"; }
+	static const bool can_iterate = true;
+
+	soa_slot_map<int, float> map;
+	int next;
+
+	soa_strategy() : next(0) {}
+	handle create() { return map.create(next++, 0.0f); }
+	bool get(handle id) { return map.contains(id); }
+	void destroy(handle id) { map.destroy(id); }
+
+	// one column only, which is the point of the layout
+	long long iterate()
+	{
+		long long sum = 0;
+		const int* column = map.column<int>();
+		for (size_t i = 0; i < map.size(); ++i)
+			sum += column[i];
+		return sum;
+	}
+};
+
+// single-threaded here, so this is the cost of the atomics alone.
+struct concurrent_strategy
+{
+	typedef concurrent_slot_map<int>::handle handle;
+	static const char* name() { return "concurrent_slot_map"; }
+	static const bool can_iterate = false;
+
+	concurrent_slot_map<int> map;
+	int next;
+
+	concurrent_strategy() : map(16 * 1024 * 1024), next(0) {}
+	handle create() { return map.create(next++); }
+	bool get(handle id) { return map.get(id) != nullptr; }
+	void destroy(handle id) { map.destroy(id); }
+	long long iterate() { return 0; }
+};
+
+// same map through a per-thread slot cache, so create and destroy only hit
+// the shared free list once per 64 slots.
+struct concurrent_cached_strategy : concurrent_strategy
+{
+	static const char* name() { return "concurrent cached"; }
+
+	concurrent_slot_map<int>::slot_cache cache;
+
+	concurrent_cached_strategy() : cache(map) {}
+	handle create() { return cache.create(next++); }
+	void destroy(handle id) { cache.destroy(id); }
+};
+
+// whole-batch versions of each operation.  the generic versions loop over
+// the single-object calls; strategies with batch support overload them.
+template <typename Strategy>
+void create_all(Strategy& strategy, typename Strategy::handle* handles, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+		handles[i] = strategy.create();
+}
+
+template <typename Strategy>
+long long get_all(Strategy& strategy, const typename Strategy::handle* handles, size_t count)
+{
+	long long found = 0;
+	for (size_t i = 0; i < count; ++i)
+		found += strategy.get(handles[i]);
+	return found;
+}
+
+template <typename Strategy>
+void destroy_all(Strategy& strategy, const typename Strategy::handle* handles, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+		strategy.destroy(handles[i]);
+}
+
+void create_all(slot_map_batch_strategy& strategy, slot_map<int>::handle* handles, size_t count)
+{
+	strategy.map.create_n(count, handles, 0);
+}
+
+long long get_all(slot_map_batch_strategy& strategy, const slot_map<int>::handle* handles, size_t count)
+{
+	long long found = 0;
+	for (size_t first = 0; first < count; first += slot_map_batch_strategy::lookup_batch)
+	{
+		size_t n = count - first < slot_map_batch_strategy::lookup_batch ? count - first : slot_map_batch_strategy::lookup_batch;
+		found += static_cast<long long>(strategy.map.get_n(handles + first, n, strategy.pointers));
+	}
+	return found;
+}
+
+void destroy_all(slot_map_batch_strategy& strategy, const slot_map<int>::handle* handles, size_t count)
+{
+	strategy.map.destroy_n(handles, count);
+}
+
+enum operation { op_create, op_get_hit, op_iterate, op_destroy, op_get_stale, op_count };
+
+static const char* operation_names[op_count] = { "create", "get hit", "iterate", "destroy", "get stale" };
+
+// runs the create/get/iterate/destroy/get cycle enough times to add up to at
+// least a million operations each, and prints one row of results.  the map
+// is not reset between cycles, so later cycles measure the steady state of
+// recycling slots, which is the interesting case.
+template <typename Strategy>
+void run(size_t count, bool random, cache_miss_counter& counter)
+{
+	measurement results[op_count];
+
+	size_t cycles = count >= 1000000 ? 1 : 1000000 / count;
+	std::vector<typename Strategy::handle> handles(count);
+	std::vector<typename Strategy::handle> ordered(count);
+	std::vector<size_t> order(count);
+	for (size_t i = 0; i < count; ++i)
+		order[i] = i;
+	std::mt19937 rng(12345);
+
+	{
+		Strategy strategy;
+
+		for (size_t cycle = 0; cycle < cycles; ++cycle)
+		{
+			if (random)
+				std::shuffle(order.begin(), order.end(), rng);
+
+			measure(results[op_create], counter, count, [&]()
+			{
+				create_all(strategy, handles.data(), count);
+			});
+
+			// the access pattern is applied outside the timed sections,
+			// so the batch operations see it as a plain array of handles.
+			for (size_t i = 0; i < count; ++i)
+				ordered[i] = handles[order[i]];
+
+			measure(results[op_get_hit], counter, count, [&]()
+			{
+				checksum += get_all(strategy, ordered.data(), count);
+			});
+
+			if (Strategy::can_iterate)
+			{
+				measure(results[op_iterate], counter, count, [&]()
+				{
+					checksum += strategy.iterate();
+				});
+			}
+
+			measure(results[op_destroy], counter, count, [&]()
+			{
+				destroy_all(strategy, ordered.data(), count);
+			});
+
+			measure(results[op_get_stale], counter, count, [&]()
+			{
+				checksum += get_all(strategy, ordered.data(), count);
+			});
+		}
+	}
+
+	std::printf("%-20s", Strategy::name());
+	for (int op = 0; op < op_count; ++op)
+	{
+		if (op == op_iterate && !Strategy::can_iterate)
+			std::printf("  %9s        ", "-");
+		else if (results[op].misses < 0)
+			std::printf("  %9.2f        ", results[op].nanoseconds / results[op].operations);
+		else
+			std::printf("  %9.2f %6.2fm", results[op].nanoseconds / results[op].operations, static_cast<double>(results[op].misses) / results[op].operations);
+	}
+	std::printf("\n");
+	std::fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+	size_t max_count = argc > 1 ? static_cast<size_t>(std::strtoull(argv[1], nullptr, 10)) : 10000000;
+
+	cache_miss_counter counter;
+	std::printf("ns/op%s; iterate is ns per object\n", counter.available() ? ", cache misses/op (m)" : " (cache miss counters unavailable)");
+
+	size_t sizes[] = { 1000, 100000, 10000000 };
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+	{
+		size_t count = sizes[s] < max_count ? sizes[s] : max_count;
+
+		for (int pattern = 0; pattern < 2; ++pattern)
+		{
+			bool random = pattern == 1;
+			std::printf("\n=== %zu objects, %s access ===\n", count, random ? "random" : "sequential");
+			std::printf("%-20s", "strategy");
+			for (int op = 0; op < op_count; ++op)
+				std::printf("  %-16s", operation_names[op]);
+			std::printf("\n");
+
+			run<v1_strategy>(count, random, counter);
+			run<v2_strategy>(count, random, counter);
+			run<v3_strategy>(count, random, counter);
+			run<v4_strategy>(count, random, counter);
+			run<v5_strategy>(count, random, counter);
+			run<slot_map_strategy>(count, random, counter);
+			run<slot_map_batch_strategy>(count, random, counter);
+			run<split_slot_map_strategy>(count, random, counter);
+			run<dense_strategy>(count, random, counter);
+			run<soa_strategy>(count, random, counter);
+			run<concurrent_strategy>(count, random, counter);
+			run<concurrent_cached_strategy>(count, random, counter);
+		}
+
+		if (count == max_count)
+			break;
+	}
+
+	std::printf("\nchecksum %lld\n", checksum);
+	return 0;
+}
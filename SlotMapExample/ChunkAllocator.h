@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+#if defined(_WIN32)
+#	ifndef WIN32_LEAN_AND_MEAN
+#		define WIN32_LEAN_AND_MEAN
+#	endif
+#	ifndef NOMINMAX
+#		define NOMINMAX
+#	endif
+#	include <windows.h>
+#	include <malloc.h>
+#else
+#	include <sys/mman.h>
+#	include <unistd.h>
+#endif
+
+// chunk allocators for slot_map.  a chunk allocator is anything with these two
+// members, so plugging in an engine's own pool or arena is just a small
+// adaptor struct:
+//
+//    void* allocate(size_t size, size_t alignment);
+//    void deallocate(void* ptr, size_t size, size_t alignment);
+//
+// allocate returns nullptr on failure, which slot_map reports by returning a
+// default handle from create.  the map keeps its own copy of the allocator,
+// so stateful allocators should either be cheap to copy or point at shared
+// state.
+
+// plain aligned heap allocation; this is what slot_map uses by default.
+struct heap_chunk_allocator
+{
+	void* allocate(size_t size, size_t alignment)
+	{
+#if defined(_WIN32)
+		return _aligned_malloc(size, alignment);
+#else
+		void* ptr = nullptr;
+		if (alignment < sizeof(void*))
+			alignment = sizeof(void*);
+		return posix_memalign(&ptr, alignment, size) == 0 ? ptr : nullptr;
+#endif
+	}
+
+	void deallocate(void* ptr, size_t, size_t)
+	{
+#if defined(_WIN32)
+		_aligned_free(ptr);
+#else
+		free(ptr);
+#endif
+	}
+};
+
+// allocates every chunk directly from the OS in whole pages, so chunks are
+// page-aligned and freeing one really returns the memory.  with huge_pages
+// set it asks for large pages; that needs SeLockMemoryPrivilege on Windows
+// and configured hugetlb pages on Linux, so it falls back to normal pages
+// (plus a transparent huge page hint on Linux) if the OS says no.
+// only worth it for big chunks; a chunk smaller than a page still costs a
+// page.
+struct page_chunk_allocator
+{
+	bool huge_pages;
+
+	explicit page_chunk_allocator(bool huge_pages = false) : huge_pages(huge_pages) {}
+
+	void* allocate(size_t size, size_t)
+	{
+#if defined(_WIN32)
+		if (huge_pages)
+		{
+			size_t large = GetLargePageMinimum();
+			if (large != 0)
+			{
+				void* ptr = VirtualAlloc(nullptr, (size + large - 1) & ~(large - 1), MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE);
+				if (ptr != nullptr)
+					return ptr;
+			}
+		}
+		return VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+		void* ptr = MAP_FAILED;
+#	if defined(MAP_HUGETLB)
+		if (huge_pages)
+			ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#	endif
+		if (ptr == MAP_FAILED)
+		{
+			ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (ptr == MAP_FAILED)
+				return nullptr;
+#	if defined(MADV_HUGEPAGE)
+			if (huge_pages)
+				madvise(ptr, size, MADV_HUGEPAGE);
+#	endif
+		}
+		return ptr;
+#endif
+	}
+
+	void deallocate(void* ptr, size_t size, size_t)
+	{
+#if defined(_WIN32)
+		(void)size;
+		VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+		// munmap rounds up to the page (or huge page) the same way mmap did.
+		munmap(ptr, size);
+#endif
+	}
+};
+
+// bump allocator over a caller-provided block of memory, for maps whose
+// worst case is known up front (a level's entity budget, say).  memory only
+// goes back to the arena if freed in reverse order, which is exactly the
+// order slot_map::shrink releases trailing chunks in; anything else is
+// reclaimed when the arena itself is thrown away.
+struct arena_chunk_allocator
+{
+	char* begin;
+	char* cursor;
+	char* end;
+
+	arena_chunk_allocator(void* memory, size_t size)
+		: begin(static_cast<char*>(memory))
+		, cursor(static_cast<char*>(memory))
+		, end(static_cast<char*>(memory) + size)
+	{}
+
+	void* allocate(size_t size, size_t alignment)
+	{
+		std::uintptr_t aligned = (reinterpret_cast<std::uintptr_t>(cursor) + alignment - 1) & ~static_cast<std::uintptr_t>(alignment - 1);
+		if (aligned + size > reinterpret_cast<std::uintptr_t>(end))
+			return nullptr;
+
+		cursor = reinterpret_cast<char*>(aligned + size);
+		return reinterpret_cast<void*>(aligned);
+	}
+
+	void deallocate(void* ptr, size_t size, size_t)
+	{
+		if (static_cast<char*>(ptr) + size == cursor)
+			cursor = static_cast<char*>(ptr);
+	}
+};
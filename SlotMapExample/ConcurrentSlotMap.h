@@ -0,0 +1,562 @@
+#pragma once
+
+#include "SlotMap.h"
+
+#include <atomic>
+#include <vector>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <cstddef>
+#include <cstdint>
+
+// thread-safe variant of the slot map.  create and destroy are lock-free and
+// get is wait-free, so it can be used from many job threads at once without
+// wrapping every call in a mutex.
+// the free list is an intrusive stack threaded through the free slots, with
+// the head packed as slot index (low 32 bits) plus an ABA tag (high 32 bits)
+// in a single 64-bit atomic that is bumped on every successful push or pop.
+// the chunk table is a fixed-size array of chunk pointers allocated up front,
+// so growing appends a chunk pointer and never moves existing chunks; readers
+// never see the table reallocate underneath them.
+// note that get() only guarantees that the handle was live when it looked;
+// another thread destroying the same object while you use the pointer is
+// still a use-after-free.  ownership of an object has to be handed around
+// the same way it would be for plain new/delete.
+// the exception is deferred destruction, for threads that only read (render,
+// audio) while another thread destroys things under them.  each reader thread
+// registers once and brackets its reads with a read_section; destroy_deferred
+// retires the handle right away, so get() stops finding it, but the object
+// stays put until every reader that might still hold a pointer to it has left
+// its read section.  this is the usual three-epoch scheme: retired slots go
+// on the retire list of the global epoch, collect() advances the epoch once
+// every reader in a read section has caught up with it, and whatever was
+// retired two epochs back is destroyed and recycled.  call collect() once a
+// frame or so from the destroying thread; reclaiming takes two collects after
+// the last reader that saw the object has moved on.
+template <typename T, size_t ChunkSize = 256, typename Layout = handle_layout<> >
+class concurrent_slot_map
+{
+	static_assert(ChunkSize > 0 && (ChunkSize & (ChunkSize - 1)) == 0, "ChunkSize must be a power of two");
+	static_assert(ChunkSize <= Layout::max_slots, "ChunkSize is larger than the handle layout can index");
+
+public:
+	typedef slot_handle<concurrent_slot_map, Layout> handle;
+	typedef typename handle::value_type value_type;
+
+	static const unsigned no_reader = 0xFFFFFFFF;
+
+	static const size_t chunk_size = ChunkSize;
+	static const size_t chunk_shift = slot_map_detail::log2(ChunkSize);
+	static const size_t chunk_mask = ChunkSize - 1;
+
+	// max_objects is rounded up to a whole number of chunks, and is a hard
+	// limit; the chunk table can't grow without moving.  it is also clamped
+	// to what the handle layout can index.  max_readers is how many threads
+	// can be registered for deferred destruction at once.
+	explicit concurrent_slot_map(size_t max_objects = 1 << 24, size_t max_readers = 16)
+		: max_chunks(static_cast<size_t>(((max_objects < Layout::max_slots ? max_objects : Layout::max_slots) + ChunkSize - 1) >> chunk_shift))
+		, table(new std::atomic<slot*>[max_chunks])
+		, free_head(pack_head(empty_index, 0))
+		, chunk_count(0)
+		, live_count(0)
+		, max_readers(max_readers)
+		, reader_memory(::operator new(sizeof(reader_slot) * max_readers + cache_line - 1))
+		, readers(align_readers(reader_memory))
+		, global_epoch(1)
+	{
+		for (size_t i = 0; i < max_chunks; ++i)
+			table[i].store(nullptr, std::memory_order_relaxed);
+		for (size_t i = 0; i < max_readers; ++i)
+		{
+			new (&readers[i]) reader_slot;
+			readers[i].epoch.store(quiescent, std::memory_order_relaxed);
+			readers[i].registered.store(false, std::memory_order_relaxed);
+		}
+		for (size_t i = 0; i < epoch_count; ++i)
+			retired[i].store(empty_index, std::memory_order_relaxed);
+	}
+
+	// not thread-safe; all other threads must be done with the map.
+	~concurrent_slot_map()
+	{
+		for (size_t i = 0; i < epoch_count; ++i)
+			reclaim(retired[i].exchange(empty_index), false);
+		destroy_all();
+		::operator delete(reader_memory);
+		for (size_t i = 0; i < max_chunks; ++i)
+			delete[] table[i].load(std::memory_order_relaxed);
+		delete[] table;
+	}
+
+	concurrent_slot_map(const concurrent_slot_map&) = delete;
+	concurrent_slot_map& operator=(const concurrent_slot_map&) = delete;
+
+	// lock-free.  returns a default handle if the map is full.
+	template <typename... Args>
+	handle create(Args&&... args)
+	{
+		unsigned index = pop_free();
+		if (index == empty_index)
+			return handle();
+
+		return construct_at(index, std::forward<Args>(args)...);
+	}
+
+	// wait-free: two acquire loads and a compare, no retry loops.
+	T* get(handle id)
+	{
+		slot* s = find(id);
+		return s == nullptr ? nullptr : s->object();
+	}
+
+	// lock-free.  exactly one of any number of racing destroys of the same
+	// handle wins; the rest, and destroys of stale handles, are no-ops.
+	void destroy(handle id)
+	{
+		if (destruct(id))
+			push_free(id.index(), id.index());
+	}
+
+	// per-thread front end for create and destroy, for threads that spawn
+	// and despawn a lot.  free slots are taken from the shared free list a
+	// batch at a time with a single compare-exchange, and slots freed by
+	// destroy are kept locally and handed back a batch at a time, so the
+	// number of contended operations drops by a factor of the batch size.
+	// it also keeps each thread's objects close together, since a batch is
+	// usually a run of neighbouring slots.  reserve_chunk() takes a whole new
+	// chunk straight from the chunk table, never touching the free list, for
+	// bulk spawners that are about to fill it.
+	// each thread needs its own cache; a cache is not thread-safe itself.
+	// destroy it (or flush it) before the map goes away.
+	class slot_cache
+	{
+	public:
+		explicit slot_cache(concurrent_slot_map& map, size_t batch = 64) : map(map), batch(batch > 0 ? batch : 1)
+		{
+			cached.reserve(this->batch * 2 + ChunkSize);
+		}
+
+		~slot_cache() { flush(); }
+
+		slot_cache(const slot_cache&) = delete;
+		slot_cache& operator=(const slot_cache&) = delete;
+
+		// same as concurrent_slot_map::create, from the local slots.
+		template <typename... Args>
+		handle create(Args&&... args)
+		{
+			if (cached.empty() && !refill())
+				return handle();
+
+			unsigned index = cached.back();
+			cached.pop_back();
+			return map.construct_at(index, std::forward<Args>(args)...);
+		}
+
+		// same as concurrent_slot_map::destroy, keeping the slot locally.
+		void destroy(handle id)
+		{
+			if (!map.destruct(id))
+				return;
+
+			cached.push_back(id.index());
+			if (cached.size() >= batch * 2)
+				release(batch);
+		}
+
+		// takes a whole fresh chunk for this thread, so the next ChunkSize
+		// creates are one contiguous run.  returns false if the map is at
+		// max_objects.
+		bool reserve_chunk()
+		{
+			unsigned first, last;
+			if (!map.grow_chain(first, last))
+				return false;
+
+			// pushed in reverse, so the slots get used in ascending order.
+			for (unsigned index = last + 1; index-- > first; )
+				cached.push_back(index);
+			return true;
+		}
+
+		// hands every cached slot back to the shared free list.
+		void flush() { release(cached.size()); }
+
+		size_t cached_slots() const { return cached.size(); }
+
+	private:
+		bool refill()
+		{
+			unsigned chain[256];
+			size_t count = map.pop_free_n(chain, batch < 256 ? batch : 256);
+			if (count == 0)
+				return reserve_chunk();
+
+			for (size_t i = count; i-- > 0; )
+				cached.push_back(chain[i]);
+			return true;
+		}
+
+		// the last count cached slots, linked up and pushed as one chain.
+		void release(size_t count)
+		{
+			if (count == 0)
+				return;
+
+			size_t first = cached.size() - count;
+			for (size_t i = first; i + 1 < cached.size(); ++i)
+				map.slot_at(cached[i]).next_free.store(cached[i + 1], std::memory_order_relaxed);
+			map.push_free(cached[first], cached.back());
+			cached.resize(first);
+		}
+
+		concurrent_slot_map& map;
+		const size_t batch;
+		std::vector<unsigned> cached;
+	};
+
+	// registers the calling thread as a reader for deferred destruction,
+	// once, before its first read_section.  returns no_reader if all
+	// max_readers registrations are taken.
+	unsigned add_reader()
+	{
+		for (size_t i = 0; i < max_readers; ++i)
+		{
+			bool expected = false;
+			if (readers[i].registered.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+				return static_cast<unsigned>(i);
+		}
+		return no_reader;
+	}
+
+	// must not be in a read section.
+	void remove_reader(unsigned reader)
+	{
+		readers[reader].registered.store(false, std::memory_order_release);
+	}
+
+	// pins the current epoch for one reader: nothing destroyed with
+	// destroy_deferred from here on is reclaimed until the section ends, so
+	// pointers from get() stay valid for the whole section.  keep sections
+	// short (a frame, say) and don't nest them; a reader stuck in a section
+	// holds every retired object in memory.
+	class read_section
+	{
+	public:
+		read_section(concurrent_slot_map& map, unsigned reader) : epoch(map.readers[reader].epoch)
+		{
+			// seq_cst on both sides, so that a collect that didn't see
+			// this store can't have reclaimed anything this section gets
+			// a pointer to.
+			epoch.store(map.global_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+		}
+
+		~read_section()
+		{
+			epoch.store(quiescent, std::memory_order_release);
+		}
+
+		read_section(const read_section&) = delete;
+		read_section& operator=(const read_section&) = delete;
+
+	private:
+		std::atomic<std::uint64_t>& epoch;
+	};
+
+	// lock-free.  like destroy, the handle goes stale right away, but the
+	// object is only destroyed and its slot recycled by a later collect(),
+	// once no read section can still be using it.
+	void destroy_deferred(handle id)
+	{
+		slot* s = find(id);
+		if (s == nullptr)
+			return;
+
+		value_type expected = id.value;
+		value_type retired_id = id.exhausted() ? handle().value : id.released().value;
+		if (!s->id.compare_exchange_strong(expected, retired_id, std::memory_order_seq_cst))
+			return;
+
+		live_count.fetch_sub(1, std::memory_order_relaxed);
+
+		// the epoch is read after the handle is retired, so any reader
+		// that got the object pinned this epoch or an earlier one.
+		std::atomic<unsigned>& list = retired[global_epoch.load(std::memory_order_seq_cst) % epoch_count];
+		unsigned head = list.load(std::memory_order_relaxed);
+		do
+		{
+			s->next_free.store(head, std::memory_order_relaxed);
+		}
+		while (!list.compare_exchange_weak(head, id.index(), std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	// advances the epoch if every reader in a read section has seen the
+	// current one, and reclaims what was retired two epochs ago.  returns how
+	// many objects were destroyed.  safe to call from any thread, but it's
+	// meant for the one doing the destroying.
+	size_t collect()
+	{
+		std::uint64_t epoch = global_epoch.load(std::memory_order_seq_cst);
+		for (size_t i = 0; i < max_readers; ++i)
+		{
+			std::uint64_t pinned = readers[i].epoch.load(std::memory_order_seq_cst);
+			if (pinned != quiescent && pinned != epoch)
+				return 0;
+		}
+
+		if (!global_epoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst))
+			return 0;
+
+		// epoch + 2 is epoch - 1 modulo three, the list no reader can
+		// reach any more and the next one to be filled.
+		return reclaim(retired[(epoch + 2) % epoch_count].exchange(empty_index, std::memory_order_acquire), true);
+	}
+
+	// approximate while other threads are creating or destroying.
+	size_t size() const { return live_count.load(std::memory_order_relaxed); }
+	size_t capacity() const { return chunk_count.load(std::memory_order_relaxed) * ChunkSize; }
+
+private:
+	struct slot
+	{
+		std::atomic<value_type> id;
+		std::atomic<unsigned> next_free;
+		typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type storage;
+
+		T* object() { return reinterpret_cast<T*>(&storage); }
+	};
+
+	static const unsigned empty_index = 0xFFFFFFFF;
+
+	static std::uint64_t pack_head(unsigned index, unsigned tag)
+	{
+		return static_cast<std::uint64_t>(index) | (static_cast<std::uint64_t>(tag) << 32);
+	}
+
+	static const std::uint64_t quiescent = 0;
+	static const size_t epoch_count = 3;
+
+	static const size_t cache_line = 64;
+
+	// one per registered reader, a cache line each so readers don't
+	// false-share.  quiescent outside read sections, the pinned epoch
+	// inside.
+	struct reader_slot
+	{
+		std::atomic<std::uint64_t> epoch;
+		std::atomic<bool> registered;
+		char padding[cache_line - sizeof(std::atomic<std::uint64_t>) - sizeof(std::atomic<bool>)];
+	};
+
+	// the padding only helps if the array starts on a line, and operator
+	// new doesn't promise more than alignof(max_align_t), so the array is
+	// aligned by hand inside a slightly bigger block.
+	static reader_slot* align_readers(void* memory)
+	{
+		std::uintptr_t address = reinterpret_cast<std::uintptr_t>(memory);
+		return reinterpret_cast<reader_slot*>((address + cache_line - 1) & ~static_cast<std::uintptr_t>(cache_line - 1));
+	}
+
+	static unsigned head_index(std::uint64_t head) { return static_cast<unsigned>(head & 0xFFFFFFFF); }
+	static unsigned head_tag(std::uint64_t head) { return static_cast<unsigned>(head >> 32); }
+
+	slot& slot_at(unsigned index)
+	{
+		return table[index >> chunk_shift].load(std::memory_order_acquire)[index & chunk_mask];
+	}
+
+	slot* find(handle id)
+	{
+		unsigned index = id.index();
+		if ((index >> chunk_shift) >= max_chunks)
+			return nullptr;
+
+		slot* chunk = table[index >> chunk_shift].load(std::memory_order_acquire);
+		if (chunk == nullptr)
+			return nullptr;
+
+		slot* s = chunk + (index & chunk_mask);
+		return s->id.load(std::memory_order_acquire) != id.value ? nullptr : s;
+	}
+
+	// nobody else can see the slot until we publish its handle.
+	template <typename... Args>
+	handle construct_at(unsigned index, Args&&... args)
+	{
+		slot& s = slot_at(index);
+		new (&s.storage) T(std::forward<Args>(args)...);
+		handle id = handle(s.id.load(std::memory_order_relaxed)).acquired(index);
+		s.id.store(id.value, std::memory_order_release);
+		live_count.fetch_add(1, std::memory_order_relaxed);
+		return id;
+	}
+
+	// retires the handle and destroys the object, and returns true if the
+	// slot can be recycled.  exactly one of any number of racing calls for
+	// the same handle does anything.
+	bool destruct(handle id)
+	{
+		slot* s = find(id);
+		if (s == nullptr)
+			return false;
+
+		// bumping the generation is what retires the handle, so it has
+		// to happen before the object goes away.  slots with an exhausted
+		// generation get the default handle and are never recycled.
+		value_type expected = id.value;
+		value_type retired_id = id.exhausted() ? handle().value : id.released().value;
+		if (!s->id.compare_exchange_strong(expected, retired_id, std::memory_order_acq_rel))
+			return false;
+
+		s->object()->~T();
+		live_count.fetch_sub(1, std::memory_order_relaxed);
+		return !id.exhausted();
+	}
+
+	// pops up to max slots off the free list with a single compare-exchange
+	// and returns how many it got, in list order.  the tag keeps the walk
+	// honest the same way it does for a single pop: if anyone touched the
+	// head in the meantime, the links we followed may be stale, and the
+	// compare-exchange fails.  never grows.
+	size_t pop_free_n(unsigned* out, size_t max)
+	{
+		std::uint64_t head = free_head.load(std::memory_order_acquire);
+		for (;;)
+		{
+			size_t count = 0;
+			unsigned next = head_index(head);
+			while (count < max && next != empty_index)
+			{
+				out[count++] = next;
+				next = slot_at(next).next_free.load(std::memory_order_relaxed);
+			}
+			if (count == 0)
+				return 0;
+
+			if (free_head.compare_exchange_weak(head, pack_head(next, head_tag(head) + 1), std::memory_order_acq_rel, std::memory_order_acquire))
+				return count;
+		}
+	}
+
+	// pops one slot off the free list, growing if it is empty.  the tag
+	// protects against another thread popping and re-pushing the head
+	// between our load of its next_free and the compare-exchange.
+	unsigned pop_free()
+	{
+		std::uint64_t head = free_head.load(std::memory_order_acquire);
+		for (;;)
+		{
+			unsigned index = head_index(head);
+			if (index == empty_index)
+				return grow();
+
+			unsigned next = slot_at(index).next_free.load(std::memory_order_relaxed);
+			if (free_head.compare_exchange_weak(head, pack_head(next, head_tag(head) + 1), std::memory_order_acq_rel, std::memory_order_acquire))
+				return index;
+		}
+	}
+
+	// pushes the chain first..last, already linked through next_free,
+	// onto the free list.
+	void push_free(unsigned first, unsigned last)
+	{
+		slot& tail = slot_at(last);
+		std::uint64_t head = free_head.load(std::memory_order_relaxed);
+		do
+		{
+			tail.next_free.store(head_index(head), std::memory_order_relaxed);
+		}
+		while (!free_head.compare_exchange_weak(head, pack_head(first, head_tag(head) + 1), std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	// appends a new chunk, keeps its first slot for the caller and pushes the
+	// rest on the free list as one chain.  several threads may grow at once
+	// when the free list runs dry; each just gets its own chunk.
+	unsigned grow()
+	{
+		unsigned first, last;
+		if (!grow_chain(first, last))
+			return empty_index;
+
+		if (last > first)
+			push_free(first + 1, last);
+		return first;
+	}
+
+	// appends a new chunk and returns its usable slots as the chain
+	// first..last, linked in ascending order and not on the free list.
+	bool grow_chain(unsigned& first, unsigned& last)
+	{
+		size_t chunk_index = chunk_count.fetch_add(1, std::memory_order_relaxed);
+		if (chunk_index >= max_chunks)
+		{
+			chunk_count.fetch_sub(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		// the reserved all-ones index is never linked.
+		slot* chunk = new slot[ChunkSize];
+		unsigned base = static_cast<unsigned>(chunk_index * ChunkSize);
+		unsigned end = static_cast<unsigned>(std::uint64_t(base) + ChunkSize < Layout::max_slots ? std::uint64_t(base) + ChunkSize : Layout::max_slots);
+		for (unsigned i = 0; i < ChunkSize; ++i)
+		{
+			chunk[i].id.store(handle(Layout::index_mask, 0).value, std::memory_order_relaxed);
+			chunk[i].next_free.store(base + i + 1, std::memory_order_relaxed);
+		}
+		table[chunk_index].store(chunk, std::memory_order_release);
+
+		first = base;
+		last = end - 1;
+		return true;
+	}
+
+	// destroys the objects on a retire list and, if recycle is set, puts
+	// their slots back on the free list.  slots retired with an exhausted
+	// generation hold the default handle and stay out of circulation.
+	size_t reclaim(unsigned index, bool recycle)
+	{
+		size_t count = 0;
+		while (index != empty_index)
+		{
+			slot& s = slot_at(index);
+			unsigned next = s.next_free.load(std::memory_order_relaxed);
+			s.object()->~T();
+			if (recycle && s.id.load(std::memory_order_relaxed) != handle().value)
+				push_free(index, index);
+			index = next;
+			++count;
+		}
+		return count;
+	}
+
+	// live slots are exactly the ones whose stored handle has their own
+	// index; only sound once no other thread is touching the map.
+	void destroy_all()
+	{
+		if (std::is_trivially_destructible<T>::value || live_count.load() == 0)
+			return;
+
+		std::uint64_t count = chunk_count.load() < max_chunks ? chunk_count.load() : max_chunks;
+		for (std::uint64_t i = 0; i < count * ChunkSize && i < Layout::max_slots; ++i)
+		{
+			slot& s = slot_at(static_cast<unsigned>(i));
+			if (handle(s.id.load()).index() == i)
+				s.object()->~T();
+		}
+	}
+
+	const size_t max_chunks;
+	std::atomic<slot*>* table;
+	std::atomic<std::uint64_t> free_head;
+	std::atomic<size_t> chunk_count;
+	std::atomic<size_t> live_count;
+
+	const size_t max_readers;
+	void* const reader_memory;
+	reader_slot* const readers;
+	std::atomic<std::uint64_t> global_epoch;
+	// heads of the retire lists, threaded through next_free like the free
+	// list; only ever pushed to and taken whole, so no ABA tag needed.
+	std::atomic<unsigned> retired[epoch_count];
+};
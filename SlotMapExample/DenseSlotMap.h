@@ -0,0 +1,219 @@
+#pragma once
+
+#include "SlotMap.h"
+
+#include <vector>
+#include <utility>
+#include <cassert>
+#include <cstddef>
+
+// the handle bookkeeping of the packed slot maps: an indirection table from
+// slot index to position in the packed arrays, the reverse mapping from
+// position back to handle, and the free list, which is threaded through the
+// position field of the free entries.  doesn't store any payload; the
+// maps built on it keep their payload arrays in lockstep with the positions
+// handed out here.
+template <typename Handle>
+class dense_slot_index
+{
+public:
+	dense_slot_index() : free_head(empty_index) {}
+
+	// true if every index the handle layout allows is in use; push() must
+	// not be called then.
+	bool full() const
+	{
+		return free_head == empty_index && sparse.size() >= Handle::layout::max_slots;
+	}
+
+	// does everything push() might need to allocate for, so that push()
+	// itself can't throw: puts a fresh entry on the free list if it's
+	// empty, and makes room for one more handle in the packed array.
+	// calling it again before push() is harmless.
+	void prepare()
+	{
+		if (free_head == empty_index)
+		{
+			sparse.push_back(entry());
+			sparse.back().id = Handle(Handle::layout::index_mask, 0);
+			sparse.back().position = empty_index;
+			free_head = static_cast<unsigned>(sparse.size() - 1);
+		}
+
+		if (dense_ids.size() == dense_ids.capacity())
+			dense_ids.reserve(dense_ids.size() * 2 + 1);
+	}
+
+	// allocates a handle for a new object at position size().  prepare()
+	// must have been called first.
+	Handle push()
+	{
+		assert(free_head != empty_index && dense_ids.size() < dense_ids.capacity());
+
+		unsigned index = free_head;
+		entry& e = sparse[index];
+		free_head = e.position;
+
+		e.id = e.id.acquired(index);
+		e.position = static_cast<unsigned>(dense_ids.size());
+		dense_ids.push_back(e.id);
+		return e.id;
+	}
+
+	// looks up the position of a live handle.  returns false for stale
+	// handles, default handles, and handles that index past the end of the
+	// table.
+	bool find(Handle id, unsigned& position) const
+	{
+		unsigned index = id.index();
+		if (index >= sparse.size() || sparse[index].id != id)
+			return false;
+
+		position = sparse[index].position;
+		return true;
+	}
+
+	// releases the handle at the given position.  the caller must already
+	// have moved its payload at position size() - 1 into position, which is
+	// where the handle for it is moved to here.
+	void erase(unsigned position)
+	{
+		unsigned index = dense_ids[position].index();
+		entry& e = sparse[index];
+		if (e.id.exhausted())
+		{
+			// retired; the default handle never matches a live one.
+			e.id = Handle();
+		}
+		else
+		{
+			e.id = e.id.released();
+			e.position = free_head;
+			free_head = index;
+		}
+
+		unsigned last = static_cast<unsigned>(dense_ids.size() - 1);
+		if (position != last)
+		{
+			dense_ids[position] = dense_ids[last];
+			sparse[dense_ids[position].index()].position = position;
+		}
+		dense_ids.pop_back();
+	}
+
+	size_t size() const { return dense_ids.size(); }
+
+	void reserve(size_t count)
+	{
+		dense_ids.reserve(count);
+		sparse.reserve(count);
+	}
+
+	Handle handle_at(size_t position) const { return dense_ids[position]; }
+
+private:
+	static const unsigned empty_index = 0xFFFFFFFF;
+
+	// position in the packed arrays while live, next free entry while free.
+	struct entry
+	{
+		Handle id;
+		unsigned position;
+	};
+
+	std::vector<Handle> dense_ids;
+	std::vector<entry> sparse;
+	unsigned free_head;
+};
+
+// packed variant of the slot map.  the objects themselves live in one
+// contiguous array with no holes, and handles go through an indirection table
+// that maps the slot index to the object's position in that array.  destroy
+// moves the last object into the hole (swap-and-pop) and patches the
+// indirection for it.
+// the trade-off versus slot_map: iterating all live objects is a linear walk
+// over exactly size() objects, instead of probing every slot of every chunk,
+// but get() is two dependent loads instead of one and objects move around,
+// so pointers returned by get() are only good until the next create or
+// destroy.
+template <typename T, typename Layout = handle_layout<> >
+class dense_slot_map
+{
+public:
+	typedef slot_handle<dense_slot_map, Layout> handle;
+
+	typedef T* iterator;
+	typedef const T* const_iterator;
+
+	// constructs a new object at the end of the dense array.  returns a
+	// default handle if every index the handle layout allows is in use.
+	template <typename... Args>
+	handle create(Args&&... args)
+	{
+		if (index.full())
+			return handle();
+
+		// the index allocates first: if that throws nothing has changed,
+		// and if the constructor throws the index is just left with a
+		// spare free entry.  either way the two arrays stay in step.
+		index.prepare();
+		dense.emplace_back(std::forward<Args>(args)...);
+		return index.push();
+	}
+
+	// O(1) via the indirection table.  returns nullptr for stale handles,
+	// default handles, and handles that index past the end of the table.
+	T* get(handle id)
+	{
+		unsigned position;
+		return index.find(id, position) ? &dense[position] : nullptr;
+	}
+
+	const T* get(handle id) const
+	{
+		return const_cast<dense_slot_map*>(this)->get(id);
+	}
+
+	// swap-and-pop: the last object is moved into the destroyed object's
+	// position, so the dense array stays packed.  destroying a stale handle
+	// is a no-op.
+	void destroy(handle id)
+	{
+		unsigned position;
+		if (!index.find(id, position))
+			return;
+
+		if (position != dense.size() - 1)
+			dense[position] = std::move(dense.back());
+		dense.pop_back();
+		index.erase(position);
+	}
+
+	size_t size() const { return dense.size(); }
+	bool empty() const { return dense.empty(); }
+
+	// makes room for count objects up front, so that creating up to that
+	// many never reallocates.  more than that still works, it just grows.
+	void reserve(size_t count)
+	{
+		dense.reserve(count);
+		index.reserve(count);
+	}
+
+	// the packed objects, in no particular order.  this is what per-frame
+	// updates should walk.
+	T* data() { return dense.data(); }
+	const T* data() const { return dense.data(); }
+
+	iterator begin() { return dense.data(); }
+	iterator end() { return dense.data() + dense.size(); }
+	const_iterator begin() const { return dense.data(); }
+	const_iterator end() const { return dense.data() + dense.size(); }
+
+	// handle of the object at the given position in the dense array.
+	handle handle_at(size_t position) const { return index.handle_at(position); }
+
+private:
+	std::vector<T> dense;
+	dense_slot_index<handle> index;
+};
@@ -1,151 +1,37 @@
 #include <vector>
-#include <map>
 #include <cassert>
+#include <thread>
+#include <atomic>
+#include <cstdint>
 #include <cstring>
 
-// very slow id-object map
-namespace v1
-{
-	struct object {
-		object() {}
-		object(int id) : id(id) {}
-
-		int id;
-		// other fields
-	};
-
-	int next_id = 0;
-	std::map<int, object> object_table;
-
-	int create_object() {
-		object_table[next_id] = object(next_id);
-		return next_id++;
-	}
-
-	object* get_object(int id) {
-		auto iter = object_table.find(id);
-		return iter == object_table.end() ? nullptr : &iter->second;
-	}
-
-	void destroy_object(int id) {
-		auto iter = object_table.find(id);
-		if (iter != object_table.end())
-			object_table.erase(iter);
-	}
-}
-
-// incomplete id-object map
-namespace v2 {
-	struct object {
-		object(int id) : id(id) {}
-
-		int id;
-		// other fields
-	};
-
-	std::vector<object> object_table;
-	std::vector<int> free_list;
-
-	int create_object() {
-		if (!free_list.empty()) {
-			int free = free_list.back();
-			free_list.pop_back();
-			object_table[free].id = free;
-			return free;
-		} else {
-			int id = object_table.size();
-			object_table.push_back(object(id));
-			return id;
-		}
-	}
-
-	object* get_object(int id) {
-		return object_table[id].id == -1 ? nullptr : &object_table[id];
-	}
-
-	void destroy_object(int id) {
-		object_table[id].id = -1;
-		free_list.push_back(id);
-	}
-}
-
-// fast object table with id recycling bug unfixed
-namespace v3 {
-	struct object {
-		int id;
-
-		// other fields
-	};
-
-	const size_t chunk_size = 256;
-	std::vector<object*> object_table;
-	std::vector<int> free_list;
-
-	int create_object() {
-		if (free_list.empty()) {
-			object* chunk = new object[chunk_size];
-			for (int i = chunk_size - 1; i >= 0; --i)
-				free_list.push_back(object_table.size() * chunk_size + i);
-			object_table.push_back(chunk);
-		}
-
-		int free = free_list.back();
-		free_list.pop_back();
-		object_table[free / chunk_size][free % chunk_size].id = free;
-		return free;
-	}
-
-	object* get_object(int id) {
-		object* obj = object_table[id / chunk_size] + (id % chunk_size);
-		return obj->id == -1 ? nullptr : obj;
-	}
+#include "ObjectTables.h"
+#include "SlotMap.h"
+#include "DenseSlotMap.h"
+#include "SoaSlotMap.h"
+#include "ConcurrentSlotMap.h"
+#include "TrackedSlotMap.h"
 
-	void destroy_object(int id) {
-		get_object(id)->id = -1;
-		free_list.push_back(id);
-	}
-}
-
-// complete simplified slot map
-namespace v4 {
-	typedef long long object_id;
-
-	struct object {
-		object_id id;
-
-		// other fields
-	};
-
-	const size_t chunk_size = 256;
-	std::vector<object*> object_table;
-	std::vector<int> free_list;
-
-	object_id create_object() {
-		if (free_list.empty()) {
-			object* chunk = new object[chunk_size];
-			for (int i = chunk_size - 1; i >= 0; --i) {
-				chunk[i].id = object_table.size() * chunk_size + i;
-				free_list.push_back(object_table.size() * chunk_size + i);
-			}
-			object_table.push_back(chunk);
-		}
-
-		int free = free_list.back();
-		free_list.pop_back();
-		return object_table[free / chunk_size][free % chunk_size].id;
-	}
+// throws when a negative value is copied, to test the soa map's rollback.
+struct picky_component
+{
+	int value;
 
-	object* get_object(object_id id) {
-		object* obj = object_table[(id & 0xFFFFFFFF) / chunk_size] + ((id & 0xFFFFFFFF) % chunk_size);
-		return obj->id != id ? nullptr : obj;
+	explicit picky_component(int value) : value(value) {}
+	picky_component(const picky_component& other) : value(other.value)
+	{
+		if (value < 0)
+			throw value;
 	}
+};
 
-	void destroy_object(object_id id) {
-		object* obj = get_object(id);
-		obj->id = (obj->id & 0xFFFFFFFF) | (((obj->id >> 32) + 1) << 32);
-		free_list.push_back(id & 0xFFFFFFFF);
-	}
-}
+// only callable with a const object, so a const for_each that hands out
+// mutable references doesn't compile.
+struct const_only_visitor
+{
+	void operator()(const int&) const {}
+	void operator()(int&) const = delete;
+};
 
 // exceedingly NON-exhaustive test case
 int main()
@@ -154,6 +40,17 @@ int main()
 	std::vector<int> v2_ids;
 	std::vector<int> v3_ids;
 	std::vector<v4::object_id> v4_ids;
+	std::vector<v5::object_id> v5_ids;
+
+	slot_map<int> objects;
+	std::vector<slot_map<int>::handle> object_ids;
+
+	dense_slot_map<int> dense_objects;
+	std::vector<dense_slot_map<int>::handle> dense_ids;
+	dense_objects.reserve(1000);
+
+	soa_slot_map<int, float> soa_objects;
+	std::vector<soa_slot_map<int, float>::handle> soa_ids;
 
 	for (int j = 0; j < 20; ++j)
 	{
@@ -163,6 +60,10 @@ int main()
 			v2_ids.push_back(v2::create_object());
 			v3_ids.push_back(v3::create_object());
 			v4_ids.push_back(v4::create_object());
+			v5_ids.push_back(v5::create_object());
+			object_ids.push_back(objects.create(i));
+			dense_ids.push_back(dense_objects.create(i));
+			soa_ids.push_back(soa_objects.create(i, 0.5f));
 		}
 
 		for (int i = 0; i < 1000; ++i)
@@ -171,19 +72,54 @@ int main()
 			assert(v2::get_object(v2_ids[i]) != nullptr);
 			assert(v3::get_object(v3_ids[i]) != nullptr);
 			assert(v4::get_object(v4_ids[i]) != nullptr);
+			assert(v5::get_object(v5_ids[i]) != nullptr);
+			assert(objects.get(object_ids[i]) != nullptr);
 
 			assert(v1::get_object(v1_ids[i])->id == v1_ids[i]);
 			assert(v2::get_object(v2_ids[i])->id == v2_ids[i]);
 			assert(v3::get_object(v3_ids[i])->id == v3_ids[i]);
 			assert(v4::get_object(v4_ids[i])->id == v4_ids[i]);
+			assert(v5::get_object(v5_ids[i])->id == v5_ids[i]);
+			assert(*objects.get(object_ids[i]) == i);
+			assert(*dense_objects.get(dense_ids[i]) == i);
+			assert(*soa_objects.get<int>(soa_ids[i]) == i);
+			assert(*soa_objects.get<float>(soa_ids[i]) == 0.5f);
 		}
 
+		int dense_sum = 0;
+		for (int value : dense_objects)
+			dense_sum += value;
+		assert(dense_sum == 999 * 1000 / 2);
+
+		// single-column pass over the soa map
+		float* soa_floats = soa_objects.column<float>();
+		const int* soa_ints = soa_objects.column<int>();
+		for (size_t i = 0; i < soa_objects.size(); ++i)
+			soa_floats[i] += static_cast<float>(soa_ints[i]);
+		assert(*soa_objects.get<float>(soa_ids[10]) == 10.5f);
+
 		for (int i = 0; i < 1000; ++i)
 		{
 			v1::destroy_object(v1_ids[i]);
 			v2::destroy_object(v2_ids[i]);
 			v3::destroy_object(v3_ids[i]);
 			v4::destroy_object(v4_ids[i]);
+			v5::destroy_object(v5_ids[i]);
+			objects.destroy(object_ids[i]);
+			dense_objects.destroy(dense_ids[i]);
+			soa_objects.destroy(soa_ids[i]);
+
+			// destroying from the front moves the back into the hole, so
+			// make sure the moved objects are still reachable.
+			if (i == 499)
+			{
+				assert(dense_objects.size() == 500);
+				for (int k = 500; k < 1000; ++k)
+				{
+					assert(*dense_objects.get(dense_ids[k]) == k);
+					assert(*soa_objects.get<int>(soa_ids[k]) == k);
+				}
+			}
 		}
 
 		for (int i = 0; i < 1000; ++i)
@@ -192,11 +128,543 @@ int main()
 			assert(v2::get_object(v2_ids[i]) == nullptr);
 			assert(v3::get_object(v3_ids[i]) == nullptr);
 			assert(v4::get_object(v4_ids[i]) == nullptr);
+			assert(v5::get_object(v5_ids[i]) == nullptr);
+			assert(objects.get(object_ids[i]) == nullptr);
+			assert(dense_objects.get(dense_ids[i]) == nullptr);
+			assert(!soa_objects.contains(soa_ids[i]));
 		}
 
+		assert(objects.size() == 0);
+		assert(objects.get(slot_map<int>::handle()) == nullptr);
+		assert(dense_objects.empty());
+		assert(soa_objects.empty());
+
 		v1_ids.clear();
 		v2_ids.clear();
 		v3_ids.clear();
 		v4_ids.clear();
+		v5_ids.clear();
+		object_ids.clear();
+		dense_ids.clear();
+		soa_ids.clear();
+	}
+
+	// a component that throws while being copied into its column mustn't
+	// leave the columns before it one element longer
+	soa_slot_map<int, picky_component> picky_objects;
+	bool picky_threw = false;
+	try
+	{
+		picky_objects.create(1, picky_component(-1));
+	}
+	catch (int)
+	{
+		picky_threw = true;
+	}
+	assert(picky_threw && picky_objects.empty());
+	(void)picky_threw;
+	soa_slot_map<int, picky_component>::handle picky_id = picky_objects.create(2, picky_component(20));
+	assert(*picky_objects.get<int>(picky_id) == 2 && picky_objects.get<picky_component>(picky_id)->value == 20);
+	(void)picky_id;
+
+	// 32-bit handles, with 20 bits of index and 12 bits of generation.  the
+	// slot retires after its last generation instead of wrapping.
+	typedef slot_map<int, 256, handle_layout<20, 12, retire_generation> > compact_map;
+	static_assert(sizeof(compact_map::handle) == 4, "handle_layout<20, 12> should fit in 32 bits");
+
+	compact_map compact_objects;
+	compact_map::handle first_compact = compact_objects.create(0);
+	compact_map::handle last_compact = first_compact;
+	for (int i = 0; i < 4095; ++i)
+	{
+		compact_objects.destroy(last_compact);
+		last_compact = compact_objects.create(0);
+		assert(last_compact.index() == first_compact.index());
+	}
+	assert(last_compact.generation() == 4095);
+
+	compact_objects.destroy(last_compact);
+	assert(compact_objects.get(last_compact) == nullptr);
+	assert(compact_objects.get(first_compact) == nullptr);
+	compact_map::handle recreated_compact = compact_objects.create(0);
+	assert(recreated_compact.index() != first_compact.index());
+	(void)recreated_compact;
+
+	// with wrapping, a handle exactly 2^GenerationBits destroys old aliases
+	typedef slot_map<int, 256, handle_layout<16, 2> > wrapping_map;
+
+	wrapping_map wrapping_objects;
+	wrapping_map::handle first_wrapping = wrapping_objects.create(0);
+	wrapping_map::handle last_wrapping = first_wrapping;
+	for (int i = 0; i < 4; ++i)
+	{
+		wrapping_objects.destroy(last_wrapping);
+		assert(wrapping_objects.get(first_wrapping) == nullptr);
+		last_wrapping = wrapping_objects.create(0);
+	}
+	assert(last_wrapping == first_wrapping);
+
+	// a 3-bit index has room for 7 slots, the all-ones index is reserved
+	typedef slot_map<int, 4, handle_layout<3, 8> > tiny_map;
+	tiny_map tiny_objects;
+	for (int i = 0; i < 7; ++i)
+	{
+		tiny_map::handle tiny_id = tiny_objects.create(i);
+		assert(tiny_objects.get(tiny_id) != nullptr);
+		(void)tiny_id;
+	}
+	tiny_map::handle overflow_id = tiny_objects.create(7);
+	assert(overflow_id == tiny_map::handle());
+	(void)overflow_id;
+
+	// release memory after a big unload, and make sure stale handles into
+	// the released chunks stay stale once they come back
+	slot_map<int> shrinking_objects;
+	std::vector<slot_map<int>::handle> shrinking_ids;
+	for (int i = 0; i < 4096; ++i)
+		shrinking_ids.push_back(shrinking_objects.create(i));
+
+	for (int i = 256; i < 4096; ++i)
+		shrinking_objects.destroy(shrinking_ids[i]);
+	size_t released_chunks = shrinking_objects.shrink();
+	assert(released_chunks == 15);
+	(void)released_chunks;
+	assert(shrinking_objects.capacity() == 256);
+	assert(*shrinking_objects.get(shrinking_ids[0]) == 0);
+
+	for (int i = 256; i < 4096; ++i)
+		shrinking_objects.create(i);
+	for (int i = 256; i < 4096; ++i)
+		assert(shrinking_objects.get(shrinking_ids[i]) == nullptr);
+
+	// once the handle bits fill the integer, a free slot whose next
+	// generation is the last one stores the same value as a retired slot,
+	// and must still count as free, in the chunk it was freed in and in the
+	// one grow() gives back with that floor
+	typedef slot_map<int, 256, handle_layout<30, 2> > worn_map;
+	worn_map worn_objects;
+	for (unsigned generation = 0; generation < worn_map::handle::layout::generation_mask; ++generation)
+		worn_objects.destroy(worn_objects.create(0));
+	size_t wrapped_chunks = worn_objects.shrink();
+	assert(wrapped_chunks == 1 && worn_objects.capacity() == 0);
+	worn_map::handle last_generation = worn_objects.create(1);
+	assert(last_generation.generation() == worn_map::handle::layout::generation_mask);
+	(void)last_generation;
+	worn_objects.destroy(last_generation);
+	wrapped_chunks = worn_objects.shrink();
+	assert(wrapped_chunks == 1 && worn_objects.capacity() == 0);
+	(void)wrapped_chunks;
+
+	// chunks placed in a fixed arena, which refuses to grow past it
+	static char arena[4096 * 4];
+	typedef slot_map<int, 256, handle_layout<>, arena_chunk_allocator> arena_map;
+	arena_map arena_objects(arena_chunk_allocator(arena, sizeof(arena)));
+	int arena_count = 0;
+	while (arena_objects.create(arena_count) != arena_map::handle())
+		++arena_count;
+	assert(arena_count > 0 && arena_count % 256 == 0);
+
+	slot_map<int, 1024, handle_layout<>, page_chunk_allocator> page_objects;
+	slot_map<int, 1024, handle_layout<>, page_chunk_allocator>::handle page_id = page_objects.create(5);
+	assert(*page_objects.get(page_id) == 5);
+	(void)page_id;
+
+	// batch versions of create, get, and destroy
+	slot_map<int> batch_objects;
+	std::vector<slot_map<int>::handle> batch_ids(1000);
+	std::vector<int*> batch_ptrs(1000);
+	size_t batch_created = batch_objects.create_n(1000, batch_ids.data(), 42);
+	assert(batch_created == 1000);
+	(void)batch_created;
+	assert(batch_objects.size() == 1000);
+	// fresh chunks are handed out in slot order, across chunks too
+	for (int i = 0; i < 1000; ++i)
+		assert(batch_ids[i].index() == static_cast<unsigned>(i));
+
+	size_t batch_found = batch_objects.get_n(batch_ids.data(), 1000, batch_ptrs.data());
+	assert(batch_found == 1000);
+	for (int i = 0; i < 1000; ++i)
+		assert(batch_ptrs[i] == batch_objects.get(batch_ids[i]) && *batch_ptrs[i] == 42);
+
+	// destroying a handle twice in one batch only destroys it once
+	batch_objects.destroy_n(batch_ids.data(), 500);
+	batch_objects.destroy_n(batch_ids.data() + 499, 2);
+	assert(batch_objects.size() == 499);
+	batch_ids.push_back(slot_map<int>::handle());
+	batch_ptrs.resize(1001);
+	batch_found = batch_objects.get_n(batch_ids.data(), 1001, batch_ptrs.data());
+	assert(batch_found == 499);
+	for (int i = 0; i < 1001; ++i)
+		assert((batch_ptrs[i] != nullptr) == (i >= 501 && i < 1000));
+	int batch_live = 0;
+	batch_objects.for_each([&batch_live](int) { ++batch_live; });
+	assert(batch_live == 499);
+
+	// a table too big for the cache, so the batches prefetch, looked up
+	// and destroyed in scattered order
+	slot_map<int> scattered_objects;
+	std::vector<slot_map<int>::handle> scattered_ids(100000);
+	scattered_objects.create_n(scattered_ids.size(), scattered_ids.data(), 7);
+	for (size_t i = 0; i < scattered_ids.size(); ++i)
+		std::swap(scattered_ids[i], scattered_ids[(i * 7919) % scattered_ids.size()]);
+	std::vector<int*> scattered_ptrs(scattered_ids.size());
+	scattered_objects.destroy_n(scattered_ids.data(), scattered_ids.size() / 2);
+	batch_found = scattered_objects.get_n(scattered_ids.data(), scattered_ids.size(), scattered_ptrs.data());
+	assert(batch_found == scattered_ids.size() / 2 && scattered_objects.size() == batch_found);
+	for (size_t i = 0; i < scattered_ids.size(); ++i)
+		assert((scattered_ptrs[i] != nullptr) == (i >= scattered_ids.size() / 2));
+	(void)batch_found;
+
+	// sparse iteration: every third object survives, and the iterator and
+	// for_each visit exactly those, in slot order
+	slot_map<int> sparse_objects;
+	std::vector<slot_map<int>::handle> sparse_ids;
+	for (int i = 0; i < 1000; ++i)
+		sparse_ids.push_back(sparse_objects.create(i));
+	for (int i = 0; i < 1000; ++i)
+		if (i % 3 != 0)
+			sparse_objects.destroy(sparse_ids[i]);
+
+	int sparse_visited = 0;
+	for (slot_map<int>::iterator iter = sparse_objects.begin(); iter != sparse_objects.end(); ++iter)
+	{
+		assert(*iter == sparse_visited * 3);
+		assert(iter.id() == sparse_ids[*iter]);
+		++sparse_visited;
+	}
+	assert(sparse_visited == 334);
+
+	int sparse_sum = 0;
+	const slot_map<int>& const_sparse = sparse_objects;
+	const_sparse.for_each([&sparse_sum](const int& value) { sparse_sum += value; });
+	for (int value : const_sparse)
+		sparse_sum -= value;
+	assert(sparse_sum == 0);
+	const_sparse.for_each(const_only_visitor());
+
+	// destroying behind the iterator is fine
+	for (slot_map<int>::iterator iter = sparse_objects.begin(); iter != sparse_objects.end(); )
+		sparse_objects.destroy((iter++).id());
+	assert(sparse_objects.size() == 0 && sparse_objects.begin() == sparse_objects.end());
+
+	// flat snapshot and reload; every handle means the same thing after,
+	// and the reloaded map hands out the same handles next
+	slot_map<int> saved_objects;
+	std::vector<slot_map<int>::handle> saved_ids;
+	for (int i = 0; i < 1000; ++i)
+		saved_ids.push_back(saved_objects.create(i));
+	for (int i = 0; i < 1000; i += 3)
+		saved_objects.destroy(saved_ids[i]);
+
+	std::vector<char> image(saved_objects.image_size());
+	size_t short_saved = saved_objects.save(image.data(), image.size() - 1);
+	size_t saved = saved_objects.save(image.data(), image.size());
+	assert(short_saved == 0 && saved == image.size());
+	(void)short_saved;
+	(void)saved;
+
+	slot_map<int> loaded_objects;
+	loaded_objects.create(-1);
+	bool loaded = loaded_objects.load(image.data(), image.size());
+	assert(loaded);
+	(void)loaded;
+	assert(loaded_objects.size() == saved_objects.size());
+	for (int i = 0; i < 1000; ++i)
+	{
+		if (i % 3 == 0)
+			assert(loaded_objects.get(saved_ids[i]) == nullptr);
+		else
+			assert(*loaded_objects.get(saved_ids[i]) == i);
+	}
+	for (int i = 0; i < 10; ++i)
+	{
+		slot_map<int>::handle loaded_id = loaded_objects.create(i);
+		slot_map<int>::handle saved_id = saved_objects.create(i);
+		assert(loaded_id == saved_id);
+		(void)loaded_id;
+		(void)saved_id;
+	}
+
+	int loaded_sum = 0;
+	loaded_objects.for_each([&loaded_sum](int value) { loaded_sum += value; });
+	int saved_sum = 0;
+	saved_objects.for_each([&saved_sum](int value) { saved_sum += value; });
+	assert(loaded_sum == saved_sum);
+
+	// images only load into the same kind of map, down to the slot layout:
+	// split and interleaved chunks of ints have the same size
+	slot_map<int, 64> other_objects;
+	loaded = other_objects.load(image.data(), image.size());
+	assert(!loaded);
+	slot_map<int, 256, handle_layout<>, heap_chunk_allocator, split_slots<> > split_image_objects;
+	loaded = split_image_objects.load(image.data(), image.size());
+	assert(!loaded);
+	loaded = loaded_objects.load(image.data(), 100);
+	assert(!loaded && loaded_objects.size() == 0);
+
+	// and not at all if the header disagrees with the occupancy bitmap
+	std::vector<char> corrupted(image);
+	std::uint32_t bad_free_head = static_cast<std::uint32_t>(saved_objects.capacity());
+	std::memcpy(corrupted.data() + 28, &bad_free_head, sizeof(bad_free_head));
+	loaded = loaded_objects.load(corrupted.data(), corrupted.size());
+	assert(!loaded);
+	std::uint32_t live_free_head = saved_ids[1].index();
+	std::memcpy(corrupted.data() + 28, &live_free_head, sizeof(live_free_head));
+	loaded = loaded_objects.load(corrupted.data(), corrupted.size());
+	assert(!loaded);
+	corrupted = image;
+	std::uint64_t bad_live_count;
+	std::memcpy(&bad_live_count, corrupted.data() + 48, sizeof(bad_live_count));
+	++bad_live_count;
+	std::memcpy(corrupted.data() + 48, &bad_live_count, sizeof(bad_live_count));
+	loaded = loaded_objects.load(corrupted.data(), corrupted.size());
+	assert(!loaded && loaded_objects.size() == 0);
+
+	// or if a count is big enough to wrap the size check around
+	corrupted = image;
+	std::uint64_t wrapping_count = std::uint64_t(1) << 62;
+	std::memcpy(corrupted.data() + 56, &wrapping_count, sizeof(wrapping_count));
+	loaded = loaded_objects.load(corrupted.data(), corrupted.size());
+	assert(!loaded);
+	corrupted = image;
+	std::memcpy(corrupted.data() + 40, &wrapping_count, sizeof(wrapping_count));
+	loaded = loaded_objects.load(corrupted.data(), corrupted.size());
+	assert(!loaded && loaded_objects.size() == 0);
+	corrupted = image;
+	loaded = loaded_objects.load(corrupted.data(), corrupted.size());
+	assert(loaded);
+
+	// change tracking: one frame of creates, one of mixed changes, netted
+	// out per slot
+	tracked_slot_map<int> tracked_objects;
+	std::vector<tracked_slot_map<int>::handle> tracked_ids;
+	for (int i = 0; i < 300; ++i)
+		tracked_ids.push_back(tracked_objects.create(i));
+
+	int tracked_created = 0;
+	tracked_objects.for_each_created([&](tracked_slot_map<int>::handle id, const int& value) { assert(id == tracked_ids[value]); (void)id; (void)value; ++tracked_created; });
+	assert(tracked_created == 300);
+	tracked_objects.clear_changes();
+	assert(!tracked_objects.has_changes());
+
+	*tracked_objects.modify(tracked_ids[10]) = 1010;
+	*tracked_objects.modify(tracked_ids[200]) = 1200;
+	tracked_objects.destroy(tracked_ids[200]);
+	tracked_objects.destroy(tracked_ids[20]);
+	tracked_slot_map<int>::handle tracked_replacement = tracked_objects.create(2020);
+	assert(tracked_replacement.index() == tracked_ids[20].index() && tracked_replacement != tracked_ids[20]);
+	(void)tracked_replacement;
+	tracked_objects.destroy(tracked_objects.create(-1));
+	assert(tracked_objects.has_changes());
+
+	std::vector<unsigned> tracked_changes;
+	tracked_objects.for_each_modified([&](tracked_slot_map<int>::handle id, const int& value) { assert(id == tracked_ids[10] && value == 1010); (void)value; tracked_changes.push_back(id.index()); });
+	tracked_objects.for_each_created([&](tracked_slot_map<int>::handle id, const int& value) { assert(id == tracked_replacement && value == 2020); (void)value; tracked_changes.push_back(id.index()); });
+	tracked_objects.for_each_destroyed([&](unsigned index) { tracked_changes.push_back(index); });
+	assert(tracked_changes.size() == 4);
+	assert(tracked_changes[2] == tracked_ids[20].index() && tracked_changes[3] == tracked_ids[200].index());
+
+	tracked_objects.clear_changes();
+	tracked_objects.for_each_destroyed([](unsigned) { assert(false); });
+	tracked_objects.destroy(tracked_objects.create(-2));
+	assert(!tracked_objects.has_changes());
+	assert(tracked_objects.size() == 299 && *tracked_objects.get(tracked_ids[10]) == 1010);
+
+	// handles in their own array, payloads after them, and with 64-byte
+	// payload slots every object gets a cache line to itself
+	typedef slot_map<int, 256, handle_layout<>, heap_chunk_allocator, split_slots<> > split_map;
+	typedef slot_map<int, 256, handle_layout<>, heap_chunk_allocator, split_slots<64> > padded_map;
+	split_map split_objects;
+	padded_map padded_objects;
+	std::vector<split_map::handle> split_ids;
+	std::vector<padded_map::handle> padded_ids;
+	for (int i = 0; i < 1000; ++i)
+	{
+		split_ids.push_back(split_objects.create(i));
+		padded_ids.push_back(padded_objects.create(i));
+	}
+
+	for (int i = 0; i < 1000; ++i)
+	{
+		assert(*split_objects.get(split_ids[i]) == i);
+		assert(*padded_objects.get(padded_ids[i]) == i);
+		assert(reinterpret_cast<std::uintptr_t>(padded_objects.get(padded_ids[i])) % 64 == 0);
+	}
+	assert(padded_objects.get(padded_ids[1]) - padded_objects.get(padded_ids[0]) == 64 / sizeof(int));
+
+	for (int i = 0; i < 1000; i += 2)
+	{
+		split_objects.destroy(split_ids[i]);
+		padded_objects.destroy(padded_ids[i]);
+	}
+
+	std::vector<int*> split_ptrs(1000);
+	size_t split_found = split_objects.get_n(split_ids.data(), 1000, split_ptrs.data());
+	assert(split_found == 500);
+	(void)split_found;
+	for (int i = 0; i < 1000; ++i)
+	{
+		assert((split_ptrs[i] != nullptr) == (i % 2 == 1));
+		assert((padded_objects.get(padded_ids[i]) != nullptr) == (i % 2 == 1));
+	}
+	assert(split_objects.size() == 500 && padded_objects.size() == 500);
+
+	int split_sum = 0;
+	split_objects.for_each([&split_sum](int value) { split_sum += value; });
+	assert(split_sum == 500 * 500);
+
+	// same pattern again, from several threads sharing one concurrent map
+	concurrent_slot_map<int> shared_objects;
+	std::vector<std::thread> workers;
+
+	for (int t = 0; t < 4; ++t)
+	{
+		workers.push_back(std::thread([&shared_objects, t]()
+		{
+			std::vector<concurrent_slot_map<int>::handle> shared_ids;
+
+			for (int j = 0; j < 20; ++j)
+			{
+				for (int i = 0; i < 1000; ++i)
+					shared_ids.push_back(shared_objects.create(t * 1000 + i));
+
+				for (int i = 0; i < 1000; ++i)
+					assert(*shared_objects.get(shared_ids[i]) == t * 1000 + i);
+
+				for (int i = 0; i < 1000; ++i)
+					shared_objects.destroy(shared_ids[i]);
+
+				for (int i = 0; i < 1000; ++i)
+					assert(shared_objects.get(shared_ids[i]) == nullptr);
+
+				shared_ids.clear();
+			}
+		}));
+	}
+
+	for (size_t t = 0; t < workers.size(); ++t)
+		workers[t].join();
+
+	assert(shared_objects.size() == 0);
+
+	// again with a slot cache per thread, half of them reserving whole
+	// chunks up front
+	concurrent_slot_map<int> cached_objects;
+	workers.clear();
+	for (int t = 0; t < 4; ++t)
+	{
+		workers.push_back(std::thread([&cached_objects, t]()
+		{
+			concurrent_slot_map<int>::slot_cache cache(cached_objects, 32);
+			std::vector<concurrent_slot_map<int>::handle> cached_ids;
+
+			for (int j = 0; j < 20; ++j)
+			{
+				if (t % 2 == 0)
+				{
+					bool reserved = cache.reserve_chunk();
+					assert(reserved);
+					(void)reserved;
+					concurrent_slot_map<int>::handle first = cache.create(-1);
+					for (int i = 1; i < 256; ++i)
+						cached_ids.push_back(cache.create(t * 1000 + i));
+					assert(cached_ids.back().index() == first.index() + 255);
+					cache.destroy(first);
+				}
+
+				for (int i = 0; i < 1000; ++i)
+					cached_ids.push_back(cache.create(t * 1000 + i));
+
+				for (size_t i = 0; i < cached_ids.size(); ++i)
+					assert(*cached_objects.get(cached_ids[i]) >= t * 1000);
+
+				for (size_t i = 0; i < cached_ids.size(); ++i)
+					cache.destroy(cached_ids[i]);
+				assert(cache.cached_slots() < 64 + 256);
+
+				for (size_t i = 0; i < cached_ids.size(); ++i)
+					assert(cached_objects.get(cached_ids[i]) == nullptr);
+
+				cached_ids.clear();
+			}
+		}));
+	}
+
+	for (size_t t = 0; t < workers.size(); ++t)
+		workers[t].join();
+
+	assert(cached_objects.size() == 0);
+
+	// deferred destruction: a pinned reader keeps a destroyed object alive
+	// until it leaves its read section and the epoch has moved on twice
+	concurrent_slot_map<int> deferred_objects;
+	unsigned deferred_reader = deferred_objects.add_reader();
+	concurrent_slot_map<int>::handle deferred_id = deferred_objects.create(7);
+	{
+		concurrent_slot_map<int>::read_section section(deferred_objects, deferred_reader);
+		int* deferred_ptr = deferred_objects.get(deferred_id);
+		deferred_objects.destroy_deferred(deferred_id);
+		assert(deferred_objects.get(deferred_id) == nullptr);
+		assert(deferred_objects.size() == 0);
+
+		for (int i = 0; i < 4; ++i)
+		{
+			size_t pinned_reclaimed = deferred_objects.collect();
+			assert(pinned_reclaimed == 0);
+			(void)pinned_reclaimed;
+		}
+		assert(*deferred_ptr == 7);
+		(void)deferred_ptr;
+	}
+	size_t deferred_reclaimed = deferred_objects.collect();
+	deferred_reclaimed += deferred_objects.collect();
+	assert(deferred_reclaimed == 1);
+	(void)deferred_reclaimed;
+	concurrent_slot_map<int>::handle reused_id = deferred_objects.create(8);
+	assert(reused_id.index() == deferred_id.index());
+	(void)reused_id;
+	deferred_objects.remove_reader(deferred_reader);
+
+	// and with a real reader thread hammering objects that the main
+	// thread keeps destroying; every object it reads must still be intact
+	struct guarded
+	{
+		int value;
+		explicit guarded(int value) : value(value) {}
+		~guarded() { value = -1; }
+	};
+
+	concurrent_slot_map<guarded> guarded_objects;
+	std::vector<concurrent_slot_map<guarded>::handle> guarded_ids(256);
+	for (size_t i = 0; i < guarded_ids.size(); ++i)
+		guarded_ids[i] = guarded_objects.create(static_cast<int>(i));
+
+	std::atomic<bool> guarded_done(false);
+	std::thread guarded_reader([&]()
+	{
+		unsigned reader = guarded_objects.add_reader();
+		while (!guarded_done.load())
+		{
+			concurrent_slot_map<guarded>::read_section section(guarded_objects, reader);
+			for (size_t i = 0; i < guarded_ids.size(); ++i)
+			{
+				const guarded* object = guarded_objects.get(guarded_ids[i]);
+				if (object != nullptr)
+					assert(object->value >= 0);
+			}
+		}
+		guarded_objects.remove_reader(reader);
+	});
+
+	for (int round = 0; round < 2000; ++round)
+	{
+		size_t i = static_cast<size_t>(round) % guarded_ids.size();
+		guarded_objects.destroy_deferred(guarded_ids[i]);
+		guarded_objects.collect();
+
+		// churn, so reclaimed slots really do get reused
+		guarded_objects.destroy_deferred(guarded_objects.create(round));
 	}
+	guarded_done.store(true);
+	guarded_reader.join();
 }
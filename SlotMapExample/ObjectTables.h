@@ -0,0 +1,235 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <cstring>
+
+// the v1-v5 experiments, shared by the SlotMapExample tests and the
+// SlotMapBenchmark.  they keep their state in globals, so include this from
+// exactly one translation unit per program; reset() frees everything so the
+// benchmark can start each run from scratch.
+
+// very slow id-object map
+namespace v1
+{
+	struct object {
+		object() {}
+		object(int id) : id(id) {}
+
+		int id;
+		// other fields
+	};
+
+	int next_id = 0;
+	std::map<int, object> object_table;
+
+	int create_object() {
+		object_table[next_id] = object(next_id);
+		return next_id++;
+	}
+
+	object* get_object(int id) {
+		auto iter = object_table.find(id);
+		return iter == object_table.end() ? nullptr : &iter->second;
+	}
+
+	void destroy_object(int id) {
+		auto iter = object_table.find(id);
+		if (iter != object_table.end())
+			object_table.erase(iter);
+	}
+
+	void reset() {
+		next_id = 0;
+		object_table.clear();
+	}
+}
+
+// incomplete id-object map
+namespace v2 {
+	struct object {
+		object(int id) : id(id) {}
+
+		int id;
+		// other fields
+	};
+
+	std::vector<object> object_table;
+	std::vector<int> free_list;
+
+	int create_object() {
+		if (!free_list.empty()) {
+			int free = free_list.back();
+			free_list.pop_back();
+			object_table[free].id = free;
+			return free;
+		} else {
+			int id = object_table.size();
+			object_table.push_back(object(id));
+			return id;
+		}
+	}
+
+	object* get_object(int id) {
+		return object_table[id].id == -1 ? nullptr : &object_table[id];
+	}
+
+	void destroy_object(int id) {
+		object_table[id].id = -1;
+		free_list.push_back(id);
+	}
+
+	void reset() {
+		std::vector<object>().swap(object_table);
+		std::vector<int>().swap(free_list);
+	}
+}
+
+// fast object table with id recycling bug unfixed
+namespace v3 {
+	struct object {
+		int id;
+
+		// other fields
+	};
+
+	const size_t chunk_size = 256;
+	std::vector<object*> object_table;
+	std::vector<int> free_list;
+
+	int create_object() {
+		if (free_list.empty()) {
+			object* chunk = new object[chunk_size];
+			for (int i = chunk_size - 1; i >= 0; --i)
+				free_list.push_back(object_table.size() * chunk_size + i);
+			object_table.push_back(chunk);
+		}
+
+		int free = free_list.back();
+		free_list.pop_back();
+		object_table[free / chunk_size][free % chunk_size].id = free;
+		return free;
+	}
+
+	object* get_object(int id) {
+		object* obj = object_table[id / chunk_size] + (id % chunk_size);
+		return obj->id == -1 ? nullptr : obj;
+	}
+
+	void destroy_object(int id) {
+		get_object(id)->id = -1;
+		free_list.push_back(id);
+	}
+
+	void reset() {
+		for (size_t i = 0; i < object_table.size(); ++i)
+			delete[] object_table[i];
+		std::vector<object*>().swap(object_table);
+		std::vector<int>().swap(free_list);
+	}
+}
+
+// complete simplified slot map
+namespace v4 {
+	typedef long long object_id;
+
+	struct object {
+		object_id id;
+
+		// other fields
+	};
+
+	const size_t chunk_size = 256;
+	std::vector<object*> object_table;
+	std::vector<int> free_list;
+
+	object_id create_object() {
+		if (free_list.empty()) {
+			object* chunk = new object[chunk_size];
+			for (int i = chunk_size - 1; i >= 0; --i) {
+				chunk[i].id = object_table.size() * chunk_size + i;
+				free_list.push_back(object_table.size() * chunk_size + i);
+			}
+			object_table.push_back(chunk);
+		}
+
+		int free = free_list.back();
+		free_list.pop_back();
+		return object_table[free / chunk_size][free % chunk_size].id;
+	}
+
+	object* get_object(object_id id) {
+		object* obj = object_table[(id & 0xFFFFFFFF) / chunk_size] + ((id & 0xFFFFFFFF) % chunk_size);
+		return obj->id != id ? nullptr : obj;
+	}
+
+	void destroy_object(object_id id) {
+		object* obj = get_object(id);
+		obj->id = (obj->id & 0xFFFFFFFF) | (((obj->id >> 32) + 1) << 32);
+		free_list.push_back(id & 0xFFFFFFFF);
+	}
+
+	void reset() {
+		for (size_t i = 0; i < object_table.size(); ++i)
+			delete[] object_table[i];
+		std::vector<object*>().swap(object_table);
+		std::vector<int>().swap(free_list);
+	}
+}
+
+// v4 with the free list threaded through the dead slots themselves, so that
+// create and destroy never touch (or grow) a side vector
+namespace v5 {
+	typedef long long object_id;
+
+	struct object {
+		object_id id;
+
+		// free slots reuse the payload to store the index of the next free
+		// slot, so the payload needs to be at least an int big.
+		union {
+			int next_free;
+			// other fields
+		};
+	};
+
+	const size_t chunk_size = 256;
+	std::vector<object*> object_table;
+	int free_head = -1;
+
+	object_id create_object() {
+		if (free_head == -1) {
+			object* chunk = new object[chunk_size];
+			int base = object_table.size() * chunk_size;
+			for (int i = 0; i < (int)chunk_size; ++i) {
+				chunk[i].id = base + i;
+				chunk[i].next_free = i + 1 < (int)chunk_size ? base + i + 1 : -1;
+			}
+			object_table.push_back(chunk);
+			free_head = base;
+		}
+
+		object* obj = object_table[free_head / chunk_size] + (free_head % chunk_size);
+		free_head = obj->next_free;
+		return obj->id;
+	}
+
+	object* get_object(object_id id) {
+		object* obj = object_table[(id & 0xFFFFFFFF) / chunk_size] + ((id & 0xFFFFFFFF) % chunk_size);
+		return obj->id != id ? nullptr : obj;
+	}
+
+	void destroy_object(object_id id) {
+		object* obj = get_object(id);
+		obj->id = (obj->id & 0xFFFFFFFF) | (((obj->id >> 32) + 1) << 32);
+		obj->next_free = free_head;
+		free_head = id & 0xFFFFFFFF;
+	}
+
+	void reset() {
+		for (size_t i = 0; i < object_table.size(); ++i)
+			delete[] object_table[i];
+		std::vector<object*>().swap(object_table);
+		free_head = -1;
+	}
+}
@@ -0,0 +1,1026 @@
+#pragma once
+
+#include "ChunkAllocator.h"
+
+#include <vector>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#	include <xmmintrin.h>
+#	include <intrin.h>
+#endif
+
+namespace slot_map_detail
+{
+	// compile-time log2 for the power-of-two chunk sizes, so that the chunk
+	// and slot lookups become a shift and a mask instead of a divide.
+	constexpr size_t log2(size_t n) { return n <= 1 ? 0 : 1 + log2(n / 2); }
+
+	// read prefetch hint, for the batch operations.
+	inline void prefetch(const void* address)
+	{
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+		_mm_prefetch(static_cast<const char*>(address), _MM_HINT_T0);
+#elif defined(__GNUC__)
+		__builtin_prefetch(address);
+#else
+		(void)address;
+#endif
+	}
+
+	// how many handles ahead the batch operations prefetch.  far enough to
+	// cover a miss to memory at a few ns per handle, close enough that the
+	// lines are still in L1 when we get there.
+	const size_t prefetch_distance = 16;
+
+	// below this many bytes of chunks the table is assumed to sit in L2,
+	// where prefetching only costs instructions.
+	const size_t prefetch_threshold = 256 * 1024;
+
+	// index of the lowest set bit; bits must not be zero.  a single tzcnt
+	// or bsf where the compiler has one.
+	inline unsigned lowest_bit(std::uint64_t bits)
+	{
+#if defined(_MSC_VER) && defined(_M_X64)
+		unsigned long index;
+		_BitScanForward64(&index, bits);
+		return static_cast<unsigned>(index);
+#elif defined(_MSC_VER) && defined(_M_IX86)
+		unsigned long index;
+		if (_BitScanForward(&index, static_cast<unsigned long>(bits)))
+			return static_cast<unsigned>(index);
+		_BitScanForward(&index, static_cast<unsigned long>(bits >> 32));
+		return static_cast<unsigned>(index) + 32;
+#elif defined(__GNUC__)
+		return static_cast<unsigned>(__builtin_ctzll(bits));
+#else
+		unsigned index = 0;
+		while ((bits & 1) == 0)
+		{
+			bits >>= 1;
+			++index;
+		}
+		return index;
+#endif
+	}
+
+	// number of set bits, for checking loaded images.  not on any hot path,
+	// so no popcnt intrinsic that older x86 parts don't have.
+	inline unsigned bit_count(std::uint64_t bits)
+	{
+#if defined(__GNUC__)
+		return static_cast<unsigned>(__builtin_popcountll(bits));
+#else
+		unsigned count = 0;
+		for (; bits != 0; bits &= bits - 1)
+			++count;
+		return count;
+#endif
+	}
+}
+
+// what happens to a slot whose generation has reached its maximum value.
+// wrapping keeps reusing the slot, so a handle that is exactly a multiple of
+// 2^GenerationBits destroys old will resolve again; retiring takes the slot
+// out of circulation forever, so stale handles can never resolve again, at
+// the cost of one dead slot per 2^GenerationBits destroys.
+struct wrap_generation {};
+struct retire_generation {};
+
+// bit layout of a handle: IndexBits of slot index in the low bits and
+// GenerationBits of generation above it, packed into the smallest unsigned
+// integer that fits.  the default is the same 32/32 split as v4::object_id;
+// something like handle_layout<20, 12> gives 4-byte handles for up to a
+// million slots.
+// the all-ones index is reserved so that default constructed handles never
+// resolve, so a layout has at most 2^IndexBits - 1 usable slots.
+template <unsigned IndexBits = 32, unsigned GenerationBits = 32, typename OverflowPolicy = wrap_generation>
+struct handle_layout
+{
+	static_assert(IndexBits > 0 && IndexBits <= 32, "IndexBits must be between 1 and 32");
+	static_assert(GenerationBits > 0 && GenerationBits <= 32, "GenerationBits must be between 1 and 32");
+
+	typedef typename std::conditional<IndexBits + GenerationBits <= 32, std::uint32_t, std::uint64_t>::type value_type;
+	typedef OverflowPolicy overflow_policy;
+
+	static const unsigned index_bits = IndexBits;
+	static const unsigned generation_bits = GenerationBits;
+	static const unsigned index_mask = static_cast<unsigned>((std::uint64_t(1) << IndexBits) - 1);
+	static const unsigned generation_mask = static_cast<unsigned>((std::uint64_t(1) << GenerationBits) - 1);
+	static const std::uint64_t max_slots = index_mask;
+	static const bool retires = std::is_same<OverflowPolicy, retire_generation>::value;
+};
+
+// handle type shared by all of the slot map variants.  the tag makes the
+// handle strongly typed, so that a handle for one map can't be handed to
+// another.  default constructed handles never resolve to an object.
+// validating a handle is still a single compare of value against the slot's
+// stored handle, whatever the layout.  free slots store their next generation
+// with the reserved index (see released()), so no handle can match a free
+// slot even after its generation wraps around.
+template <typename Tag, typename Layout = handle_layout<> >
+struct slot_handle
+{
+	typedef Layout layout;
+	typedef typename Layout::value_type value_type;
+
+	value_type value;
+
+	slot_handle() : value(~value_type(0)) {}
+	explicit slot_handle(value_type value) : value(value) {}
+	slot_handle(unsigned index, unsigned generation) : value(static_cast<value_type>(index) | (static_cast<value_type>(generation) << Layout::index_bits)) {}
+
+	unsigned index() const { return static_cast<unsigned>(value & Layout::index_mask); }
+	unsigned generation() const { return static_cast<unsigned>(value >> Layout::index_bits); }
+
+	// same slot, one generation later, wrapped to the generation bits.
+	slot_handle next_generation() const
+	{
+		return slot_handle(index(), (generation() + 1) & Layout::generation_mask);
+	}
+
+	// what a free slot stores: the generation its next handle will get,
+	// with the reserved index in place of its own.
+	slot_handle released() const
+	{
+		return slot_handle(Layout::index_mask, (generation() + 1) & Layout::generation_mask);
+	}
+
+	// the handle a free slot at index hands out next.
+	slot_handle acquired(unsigned index) const
+	{
+		return slot_handle(index, generation());
+	}
+
+	// true if destroying this handle should take its slot out of
+	// circulation instead of recycling it.
+	bool exhausted() const
+	{
+		return Layout::retires && generation() == Layout::generation_mask;
+	}
+
+	friend bool operator==(slot_handle lhs, slot_handle rhs) { return lhs.value == rhs.value; }
+	friend bool operator!=(slot_handle lhs, slot_handle rhs) { return lhs.value != rhs.value; }
+};
+
+// how slot_map lays out the slots inside each chunk.
+// interleaved_slots is the v4 layout: an array of slots, each one a handle
+// right next to its payload, so a successful get() is usually a single miss.
+// split_slots keeps all of a chunk's handles in their own cache-line-aligned
+// array at the front of the chunk and the payloads in a second array after
+// it, so validating a handle only ever touches the handle array.  stale
+// handles then cost a miss on a compact line of handles instead of on a
+// payload line, and anything scanning for live slots reads 8 or 16 handles
+// per line, but a successful get() touches two lines instead of one.
+// PayloadAlignment pads every payload slot to at least that alignment; 64
+// puts every object on its own cache line(s), so threads working on
+// neighbouring objects don't false-share.
+struct interleaved_slots {};
+
+template <size_t PayloadAlignment = 0>
+struct split_slots
+{
+	static_assert((PayloadAlignment & (PayloadAlignment - 1)) == 0, "PayloadAlignment must be zero or a power of two");
+};
+
+namespace slot_map_detail
+{
+	// free slots keep the free list link in the storage a T would use, so
+	// storage is sized for whichever of the two is bigger.
+	template <typename T>
+	struct slot_storage
+	{
+		static const size_t size = sizeof(T) > sizeof(unsigned) ? sizeof(T) : sizeof(unsigned);
+		static const size_t alignment = std::alignment_of<T>::value > std::alignment_of<unsigned>::value ? std::alignment_of<T>::value : std::alignment_of<unsigned>::value;
+		typedef typename std::aligned_storage<size, alignment>::type type;
+	};
+
+	template <typename T, typename Handle, size_t ChunkSize, typename SlotLayout>
+	struct chunk_layout;
+
+	template <typename T, typename Handle, size_t ChunkSize>
+	struct chunk_layout<T, Handle, ChunkSize, interleaved_slots>
+	{
+		struct slot
+		{
+			Handle id;
+			typename slot_storage<T>::type storage;
+		};
+
+		struct chunk
+		{
+			slot slots[ChunkSize];
+		};
+
+		static Handle& id(chunk* c, size_t i) { return c->slots[i].id; }
+		static void* storage(chunk* c, size_t i) { return &c->slots[i].storage; }
+
+		// where the first payload is and how far apart they are, so saved
+		// images record which layout they were written with.
+		static size_t payload_offset() { return offsetof(slot, storage); }
+		static size_t payload_stride() { return sizeof(slot); }
+	};
+
+	template <typename T, typename Handle, size_t ChunkSize, size_t PayloadAlignment>
+	struct chunk_layout<T, Handle, ChunkSize, split_slots<PayloadAlignment> >
+	{
+		static const size_t cache_line = 64;
+		static const size_t alignment = PayloadAlignment > slot_storage<T>::alignment ? PayloadAlignment : slot_storage<T>::alignment;
+		typedef typename std::aligned_storage<(slot_storage<T>::size + alignment - 1) & ~(alignment - 1), alignment>::type payload;
+
+		// the payloads start on a fresh line, so the handle lines hold
+		// nothing but handles.
+		struct chunk
+		{
+			alignas(cache_line) Handle ids[ChunkSize];
+			alignas(cache_line) payload payloads[ChunkSize];
+		};
+
+		static Handle& id(chunk* c, size_t i) { return c->ids[i]; }
+		static void* storage(chunk* c, size_t i) { return &c->payloads[i]; }
+
+		static size_t payload_offset() { return offsetof(chunk, payloads); }
+		static size_t payload_stride() { return sizeof(payload); }
+	};
+}
+
+// reusable version of the v4 slot map.  same idea: objects live in fixed-size
+// chunks that never move, and a handle is a slot index and a generation (32
+// bits each by default, see handle_layout).  the generation is bumped on
+// destroy, so old handles to a recycled slot stop matching.
+// differences from v4: the payload type is a template parameter, every map
+// owns its own chunks and free list (so you can have one per entity kind), the
+// handle is its own type (so handles for one map can't be handed to another),
+// objects are constructed on create and destroyed on destroy rather than
+// living forever in the chunk, the free list is threaded through the dead
+// slots like v5 instead of living in a side vector, chunks come from a
+// pluggable chunk allocator (see ChunkAllocator.h), empty trailing chunks
+// can be handed back with shrink(), the layout inside a chunk can be split
+// into separate handle and payload arrays (see split_slots), and live objects
+// can be iterated.
+// iteration goes through an occupancy bitmap, one bit per slot, kept next to
+// the chunk table; a whole 64-slot run is skipped with a single compare when
+// it's dead, and live slots are found with a trailing-zero count, so only live
+// payloads are ever touched.  objects don't move, so unlike dense_slot_map
+// iteration order is slot order and pointers stay valid throughout.
+template <typename T, size_t ChunkSize = 256, typename Layout = handle_layout<>, typename Allocator = heap_chunk_allocator, typename SlotLayout = interleaved_slots>
+class slot_map
+{
+	static_assert(ChunkSize > 0 && (ChunkSize & (ChunkSize - 1)) == 0, "ChunkSize must be a power of two");
+	static_assert(ChunkSize <= Layout::max_slots, "ChunkSize is larger than the handle layout can index");
+
+public:
+	typedef slot_handle<slot_map, Layout> handle;
+
+	static const size_t chunk_size = ChunkSize;
+	static const size_t chunk_shift = slot_map_detail::log2(ChunkSize);
+	static const size_t chunk_mask = ChunkSize - 1;
+
+	explicit slot_map(const Allocator& allocator = Allocator()) : allocator(allocator), free_head(empty_index), live_count(0) {}
+
+	~slot_map()
+	{
+		destroy_all();
+		while (!table.empty())
+			release_chunk();
+	}
+
+	// not copyable; chunks are owned and handles are tied to this instance.
+	slot_map(const slot_map&) = delete;
+	slot_map& operator=(const slot_map&) = delete;
+
+	// constructs a new object in a free slot and returns its handle.  returns
+	// a default handle if every index the handle layout allows is in use, or
+	// if the chunk allocator is out of memory.
+	template <typename... Args>
+	handle create(Args&&... args)
+	{
+		if (free_head == empty_index && !grow())
+			return handle();
+
+		// construct before popping the free list, so that a throwing
+		// constructor doesn't leak the slot.  the link lives in the
+		// storage the object is about to overwrite.
+		unsigned index = free_head;
+		unsigned next = next_free_at(index);
+		new (storage_at(index)) T(std::forward<Args>(args)...);
+		free_head = next;
+		handle& id = id_at(index);
+		id = id.acquired(index);
+		mark_live(index);
+		++live_count;
+		return id;
+	}
+
+	// returns nullptr for stale handles, default handles, and handles that
+	// index past the end of the table.
+	T* get(handle id)
+	{
+		return find(id) ? object_at(id.index()) : nullptr;
+	}
+
+	const T* get(handle id) const
+	{
+		return const_cast<slot_map*>(this)->get(id);
+	}
+
+	// destroying a stale handle is a no-op, unlike v4.
+	void destroy(handle id)
+	{
+		if (!find(id))
+			return;
+
+		unsigned index = id.index();
+		object_at(index)->~T();
+		mark_dead(index);
+		--live_count;
+
+		// retired slots get the default handle, which no live handle can
+		// match, and never go back on the free list.
+		if (id.exhausted())
+		{
+			id_at(index) = handle();
+			return;
+		}
+
+		id_at(index) = id.released();
+		next_free_at(index) = free_head;
+		free_head = index;
+	}
+
+	// creates up to count objects, each constructed from the same arguments,
+	// and writes their handles to out.  returns how many were created, which
+	// is only less than count if the map runs out of slots.  chunks are
+	// grown up front for the whole batch, and new slots come off the free
+	// list in order, so a batch into fresh chunks is handed out
+	// contiguously.  the occupancy bitmap is written once per 64-slot word
+	// and the live count once per batch.
+	template <typename... Args>
+	size_t create_n(size_t count, handle* out, const Args&... args)
+	{
+		reserve(live_count + count);
+
+		batch_marks marks(*this);
+		size_t created = 0;
+		for (; created < count; ++created)
+		{
+			if (free_head == empty_index)
+			{
+				marks.flush();
+				if (!grow())
+					break;
+			}
+
+			unsigned index = free_head;
+			chunk* c = table[index >> chunk_shift];
+			void* storage = chunk_layout::storage(c, index & chunk_mask);
+			unsigned next = *static_cast<unsigned*>(storage);
+			new (storage) T(args...);
+			free_head = next;
+			handle& id = chunk_layout::id(c, index & chunk_mask);
+			id = id.acquired(index);
+			marks.mark(index);
+			out[created] = id;
+		}
+		return created;
+	}
+
+	// looks up count handles, writing the object pointer (or nullptr for
+	// stale handles) for each to out, and returns how many were found.  the
+	// table and its size are loaded once for the batch rather than once per
+	// handle, and when the chunks are too big to stay in cache the handles
+	// are taken in groups, with the slots of the next group prefetched while
+	// this one is looked up, so the misses of a scattered batch overlap
+	// instead of being taken one at a time.
+	size_t get_n(const handle* ids, size_t count, T** out)
+	{
+		chunk* const* chunks = table.data();
+		size_t chunk_count = table.size();
+		bool prefetching = chunk_count * sizeof(chunk) > slot_map_detail::prefetch_threshold;
+
+		size_t found = 0;
+		for (size_t first = 0; first < count; first += slot_map_detail::prefetch_distance)
+		{
+			size_t last = count - first < slot_map_detail::prefetch_distance ? count : first + slot_map_detail::prefetch_distance;
+			if (prefetching)
+				prefetch_slots(chunks, chunk_count, ids + last, count - last);
+
+			for (size_t i = first; i < last; ++i)
+			{
+				handle id = ids[i];
+				T* object = nullptr;
+				if ((id.index() >> chunk_shift) < chunk_count)
+				{
+					chunk* c = chunks[id.index() >> chunk_shift];
+					size_t slot = id.index() & chunk_mask;
+					if (chunk_layout::id(c, slot) == id)
+					{
+						object = static_cast<T*>(chunk_layout::storage(c, slot));
+						++found;
+					}
+				}
+				out[i] = object;
+			}
+		}
+		return found;
+	}
+
+	// destroys count handles; stale ones are skipped as in destroy().  same
+	// prefetching as get_n, and the live count is written back once for
+	// the whole batch.
+	void destroy_n(const handle* ids, size_t count)
+	{
+		chunk* const* chunks = table.data();
+		size_t chunk_count = table.size();
+		bool prefetching = chunk_count * sizeof(chunk) > slot_map_detail::prefetch_threshold;
+
+		size_t destroyed = 0;
+		for (size_t first = 0; first < count; first += slot_map_detail::prefetch_distance)
+		{
+			size_t last = count - first < slot_map_detail::prefetch_distance ? count : first + slot_map_detail::prefetch_distance;
+			if (prefetching)
+				prefetch_slots(chunks, chunk_count, ids + last, count - last);
+
+			for (size_t i = first; i < last; ++i)
+			{
+				unsigned index = ids[i].index();
+				if ((index >> chunk_shift) < chunk_count && release(chunks[index >> chunk_shift], ids[i]))
+				{
+					mark_dead(index);
+					++destroyed;
+				}
+			}
+		}
+		live_count -= destroyed;
+	}
+
+	// grows the table until it has room for at least count objects in
+	// total.  returns false if the layout or the allocator can't provide
+	// that many.
+	bool reserve(size_t count)
+	{
+		// grow() assumes the free list is empty, so the new chunks are
+		// chained together in ascending order here, with the old list
+		// after them; a batch into them then walks memory forwards.
+		unsigned old_head = free_head;
+		unsigned first = empty_index;
+		unsigned last = empty_index;
+		bool reserved = true;
+		while (capacity() < count)
+		{
+			if (!grow())
+			{
+				reserved = false;
+				break;
+			}
+
+			if (first == empty_index)
+				first = free_head;
+			else
+				next_free_at(last) = free_head;
+			last = free_head + static_cast<unsigned>(ChunkSize) - 1;
+			if (last >= Layout::max_slots)
+				last = static_cast<unsigned>(Layout::max_slots) - 1;
+		}
+
+		if (first != empty_index)
+		{
+			next_free_at(last) = old_head;
+			free_head = first;
+		}
+		else
+		{
+			free_head = old_head;
+		}
+		return reserved;
+	}
+
+	size_t size() const { return live_count; }
+	size_t capacity() const { return table.size() * ChunkSize; }
+
+	// the handle of the live object in slot index, or a default handle if
+	// the slot is free or out of range.
+	handle handle_at(unsigned index) const
+	{
+		if ((index >> chunk_shift) >= table.size())
+			return handle();
+
+		handle id = id_at(index);
+		return id.index() == index ? id : handle();
+	}
+
+	// forward iterator over the live objects, in slot order.  creating
+	// objects invalidates iterators (the bitmap may grow); destroying the
+	// object an iterator is on is fine once it has been advanced past it.
+	template <typename Value>
+	class basic_iterator
+	{
+	public:
+		basic_iterator() : map(nullptr), word(0), bits(0) {}
+
+		Value& operator*() const { return *map->object_at(index()); }
+		Value* operator->() const { return map->object_at(index()); }
+
+		// the handle of the object the iterator is on.
+		handle id() const { return map->id_at(index()); }
+
+		basic_iterator& operator++()
+		{
+			bits &= bits - 1;
+			if (bits == 0)
+				seek(word + 1);
+			return *this;
+		}
+
+		basic_iterator operator++(int)
+		{
+			basic_iterator previous = *this;
+			++*this;
+			return previous;
+		}
+
+		friend bool operator==(const basic_iterator& lhs, const basic_iterator& rhs) { return lhs.word == rhs.word && lhs.bits == rhs.bits; }
+		friend bool operator!=(const basic_iterator& lhs, const basic_iterator& rhs) { return !(lhs == rhs); }
+
+	private:
+		friend class slot_map;
+
+		basic_iterator(slot_map* map, size_t first_word) : map(map), word(0), bits(0) { seek(first_word); }
+
+		unsigned index() const { return static_cast<unsigned>(word * 64 + slot_map_detail::lowest_bit(bits)); }
+
+		// moves to the first live slot at or after the start of the word;
+		// end is one past the last word, with no bits left.
+		void seek(size_t first_word)
+		{
+			word = first_word;
+			while (word < map->occupancy.size() && map->occupancy[word] == 0)
+				++word;
+			bits = word < map->occupancy.size() ? map->occupancy[word] : 0;
+		}
+
+		slot_map* map;
+		size_t word;
+		std::uint64_t bits;
+	};
+
+	typedef basic_iterator<T> iterator;
+	typedef basic_iterator<const T> const_iterator;
+
+	iterator begin() { return iterator(this, 0); }
+	iterator end() { return iterator(this, occupancy.size()); }
+	const_iterator begin() const { return const_iterator(const_cast<slot_map*>(this), 0); }
+	const_iterator end() const { return const_iterator(const_cast<slot_map*>(this), occupancy.size()); }
+
+	// calls function(object) for every live object, in slot order, without
+	// the iterator's bookkeeping.  the function must not create or destroy
+	// objects.
+	template <typename Function>
+	void for_each(Function function)
+	{
+		for (size_t word = 0; word < occupancy.size(); ++word)
+		{
+			for (std::uint64_t bits = occupancy[word]; bits != 0; bits &= bits - 1)
+				function(*object_at(static_cast<unsigned>(word * 64 + slot_map_detail::lowest_bit(bits))));
+		}
+	}
+
+	template <typename Function>
+	void for_each(Function function) const
+	{
+		for (size_t word = 0; word < occupancy.size(); ++word)
+		{
+			for (std::uint64_t bits = occupancy[word]; bits != 0; bits &= bits - 1)
+				function(*object_at(static_cast<unsigned>(word * 64 + slot_map_detail::lowest_bit(bits))));
+		}
+	}
+
+	// hands every chunk at the end of the table that has no live objects
+	// back to the allocator, and returns how many were released.  chunks in
+	// the middle of the table can't be released without breaking the index
+	// math, so compact by recreating if that matters.  a released chunk
+	// remembers the highest generation it handed out, so stale handles into
+	// it stay stale if it is allocated again.  chunks with retired slots are
+	// kept, since their generations can't be advanced any further.
+	// O(capacity), intended for level unloads and the like rather than
+	// every frame.
+	size_t shrink()
+	{
+		// a chunk can go once every slot in it is on the free list.  that
+		// has to come from the list itself: a free slot whose next
+		// generation is generation_mask stores exactly the default handle
+		// that marks a retired slot, so the handles alone can't tell them
+		// apart.
+		std::vector<unsigned> free_slots(table.size(), 0);
+		for (unsigned index = free_head; index != empty_index; index = next_free_at(index))
+			++free_slots[index >> chunk_shift];
+
+		size_t keep = table.size();
+		while (keep > 0 && free_slots[keep - 1] == slots_in(keep - 1))
+			--keep;
+		if (keep == table.size())
+			return 0;
+
+		// unlink the doomed slots first, while they can still be read.
+		std::uint64_t end = keep * ChunkSize;
+		unsigned* link = &free_head;
+		while (*link != empty_index)
+		{
+			if (*link >= end)
+				*link = next_free_at(*link);
+			else
+				link = &next_free_at(*link);
+		}
+
+		if (generation_floor.size() < table.size())
+			generation_floor.resize(table.size(), 0);
+
+		size_t released = table.size() - keep;
+		while (table.size() > keep)
+		{
+			generation_floor[table.size() - 1] = next_generation_in(table.size() - 1);
+			release_chunk();
+		}
+		return released;
+	}
+
+	// flat snapshots of the whole map, for save games and level streaming.
+	// the image is a small header followed by every chunk byte for byte,
+	// then the occupancy bitmap and the shrink() generation floors.  the
+	// free list is threaded through the slots by index, not by pointer, so
+	// nothing needs fixing up: loading is one allocation and one memcpy per
+	// chunk, however many objects there are, and every handle (live or
+	// stale) means exactly what it meant when the image was saved.  that
+	// only works for trivially copyable payloads.
+	// images are only portable between builds with the same payload type,
+	// chunk size, handle layout, slot layout and endianness; load() checks
+	// what it can.
+	// chunks start 64-byte aligned in the image, so an image that's mapped
+	// or read into suitably aligned memory keeps them cache-line aligned.
+	size_t image_size() const
+	{
+		return chunks_offset() + table.size() * sizeof(chunk) + occupancy.size() * sizeof(std::uint64_t) + generation_floor.size() * sizeof(unsigned);
+	}
+
+	// writes the image to buffer and returns its size, or returns 0 if
+	// buffer is smaller than image_size().
+	size_t save(void* buffer, size_t size) const
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "only slot maps of trivially copyable objects can be saved");
+
+		size_t total = image_size();
+		if (size < total)
+			return 0;
+
+		char* out = static_cast<char*>(buffer);
+		image_header header = expected_header();
+		header.free_head = free_head;
+		header.chunk_count = table.size();
+		header.live_count = live_count;
+		header.floor_count = generation_floor.size();
+		std::memset(out, 0, chunks_offset());
+		std::memcpy(out, &header, sizeof(header));
+		out += chunks_offset();
+
+		for (size_t i = 0; i < table.size(); ++i, out += sizeof(chunk))
+			std::memcpy(out, table[i], sizeof(chunk));
+
+		if (!occupancy.empty())
+			std::memcpy(out, occupancy.data(), occupancy.size() * sizeof(std::uint64_t));
+		out += occupancy.size() * sizeof(std::uint64_t);
+		if (!generation_floor.empty())
+			std::memcpy(out, generation_floor.data(), generation_floor.size() * sizeof(unsigned));
+		return total;
+	}
+
+	// replaces the contents of the map with a saved image.  returns false,
+	// and leaves the map empty, if the image doesn't match this map type,
+	// is truncated, has a free list head or live count that doesn't fit its
+	// occupancy bitmap, or the allocator runs out.
+	bool load(const void* image, size_t size)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "only slot maps of trivially copyable objects can be loaded");
+
+		while (!table.empty())
+			release_chunk();
+		generation_floor.clear();
+		free_head = empty_index;
+		live_count = 0;
+
+		image_header header;
+		if (size < sizeof(header))
+			return false;
+		std::memcpy(&header, image, sizeof(header));
+
+		image_header expected = expected_header();
+		if (header.magic != expected.magic || header.version != expected.version || header.chunk_size != expected.chunk_size
+			|| header.chunk_bytes != expected.chunk_bytes || header.object_size != expected.object_size
+			|| header.index_bits != expected.index_bits || header.generation_bits != expected.generation_bits
+			|| header.payload_offset != expected.payload_offset || header.payload_stride != expected.payload_stride)
+			return false;
+
+		// the counts come from the image, so they're bounded before anything
+		// is multiplied by them: no more chunks (or floors) than grow() could
+		// ever have made, and each array checked against what's left of the
+		// image in turn, so a corrupt count can't wrap the sums around.
+		const std::uint64_t max_chunks = (Layout::max_slots + ChunkSize - 1) / ChunkSize;
+		if (header.chunk_count > max_chunks || header.floor_count > max_chunks)
+			return false;
+
+		size_t chunk_count = static_cast<size_t>(header.chunk_count);
+		size_t words = static_cast<size_t>((header.chunk_count * ChunkSize + 63) / 64);
+		size_t floor_count = static_cast<size_t>(header.floor_count);
+		if (size < chunks_offset())
+			return false;
+		size_t remaining = size - chunks_offset();
+		if (chunk_count > remaining / sizeof(chunk))
+			return false;
+		remaining -= chunk_count * sizeof(chunk);
+		if (words > remaining / sizeof(std::uint64_t))
+			return false;
+		remaining -= words * sizeof(std::uint64_t);
+		if (floor_count > remaining / sizeof(unsigned))
+			return false;
+
+		// the bitmap has to agree with the counts in the header, or size()
+		// and create() would go wrong long after the load.  bits past the
+		// last slot must be clear, and the free list has to start at a free
+		// slot.
+		const char* bitmap = static_cast<const char*>(image) + chunks_offset() + chunk_count * sizeof(chunk);
+		std::uint64_t slots = header.chunk_count * ChunkSize;
+		std::uint64_t live = 0;
+		for (size_t i = 0; i < words; ++i)
+		{
+			std::uint64_t bits;
+			std::memcpy(&bits, bitmap + i * sizeof(bits), sizeof(bits));
+			if (i == words - 1 && (slots & 63) != 0 && (bits >> (slots & 63)) != 0)
+				return false;
+			if (i == header.free_head >> 6 && (bits >> (header.free_head & 63) & 1) != 0)
+				return false;
+			live += slot_map_detail::bit_count(bits);
+		}
+		if (live != header.live_count || (header.free_head >= slots && header.free_head != empty_index))
+			return false;
+
+		const char* in = static_cast<const char*>(image) + chunks_offset();
+		for (size_t i = 0; i < chunk_count; ++i, in += sizeof(chunk))
+		{
+			void* memory = allocator.allocate(sizeof(chunk), std::alignment_of<chunk>::value);
+			if (memory == nullptr)
+			{
+				while (!table.empty())
+					release_chunk();
+				return false;
+			}
+
+			chunk* c = new (memory) chunk;
+			std::memcpy(static_cast<void*>(c), in, sizeof(chunk));
+			table.push_back(c);
+		}
+
+		occupancy.resize(words);
+		if (words != 0)
+			std::memcpy(occupancy.data(), in, words * sizeof(std::uint64_t));
+		in += words * sizeof(std::uint64_t);
+		generation_floor.resize(floor_count);
+		if (!generation_floor.empty())
+			std::memcpy(generation_floor.data(), in, generation_floor.size() * sizeof(unsigned));
+
+		free_head = header.free_head;
+		live_count = static_cast<size_t>(header.live_count);
+		return true;
+	}
+
+private:
+	static const unsigned empty_index = 0xFFFFFFFF;
+
+	// fixed-size fields only, so the header is the same on every compiler.
+	struct image_header
+	{
+		std::uint32_t magic;
+		std::uint32_t version;
+		std::uint32_t chunk_size;
+		std::uint32_t chunk_bytes;
+		std::uint32_t object_size;
+		std::uint32_t index_bits;
+		std::uint32_t generation_bits;
+		std::uint32_t free_head;
+		std::uint32_t payload_offset;
+		std::uint32_t payload_stride;
+		std::uint64_t chunk_count;
+		std::uint64_t live_count;
+		std::uint64_t floor_count;
+	};
+
+	static image_header expected_header()
+	{
+		image_header header;
+		std::memset(&header, 0, sizeof(header));
+		header.magic = 0x50414d53; // "SMAP"
+		header.version = 2;
+		header.chunk_size = static_cast<std::uint32_t>(ChunkSize);
+		header.chunk_bytes = static_cast<std::uint32_t>(sizeof(chunk));
+		header.object_size = static_cast<std::uint32_t>(sizeof(T));
+		header.index_bits = Layout::index_bits;
+		header.generation_bits = Layout::generation_bits;
+		header.payload_offset = static_cast<std::uint32_t>(chunk_layout::payload_offset());
+		header.payload_stride = static_cast<std::uint32_t>(chunk_layout::payload_stride());
+		return header;
+	}
+
+	static size_t chunks_offset() { return (sizeof(image_header) + 63) & ~size_t(63); }
+
+	typedef slot_map_detail::chunk_layout<T, handle, ChunkSize, SlotLayout> chunk_layout;
+	typedef typename chunk_layout::chunk chunk;
+
+	// live slots hold a T in storage, free slots hold the index of the next
+	// free slot.
+	handle& id_at(unsigned index) { return chunk_layout::id(table[index >> chunk_shift], index & chunk_mask); }
+	const handle& id_at(unsigned index) const { return chunk_layout::id(table[index >> chunk_shift], index & chunk_mask); }
+	void* storage_at(unsigned index) { return chunk_layout::storage(table[index >> chunk_shift], index & chunk_mask); }
+	T* object_at(unsigned index) { return static_cast<T*>(storage_at(index)); }
+	const T* object_at(unsigned index) const { return static_cast<const T*>(chunk_layout::storage(table[index >> chunk_shift], index & chunk_mask)); }
+	unsigned& next_free_at(unsigned index) { return *static_cast<unsigned*>(storage_at(index)); }
+
+	void mark_live(unsigned index) { occupancy[index >> 6] |= std::uint64_t(1) << (index & 63); }
+	void mark_dead(unsigned index) { occupancy[index >> 6] &= ~(std::uint64_t(1) << (index & 63)); }
+
+	// how many usable slots the chunk has; all of them, except in the chunk
+	// holding the reserved all-ones index.
+	static unsigned slots_in(size_t chunk_index)
+	{
+		std::uint64_t base = chunk_index * ChunkSize;
+		return base + ChunkSize <= Layout::max_slots ? static_cast<unsigned>(ChunkSize) : static_cast<unsigned>(Layout::max_slots - base);
+	}
+
+	// the generation every slot of a re-allocated chunk starts at: one past
+	// the highest generation any slot in it has handed out so far.
+	unsigned next_generation_in(size_t chunk_index)
+	{
+		chunk* c = table[chunk_index];
+		unsigned floor = chunk_index < generation_floor.size() ? generation_floor[chunk_index] : 0;
+		for (unsigned i = 0; i < ChunkSize; ++i)
+			if (chunk_layout::id(c, i).generation() > floor)
+				floor = chunk_layout::id(c, i).generation();
+		return floor;
+	}
+
+	void release_chunk()
+	{
+		table.back()->~chunk();
+		allocator.deallocate(table.back(), sizeof(chunk), std::alignment_of<chunk>::value);
+		table.pop_back();
+		occupancy.resize((table.size() * ChunkSize + 63) / 64);
+	}
+
+	// prefetches the slot handles of the next group of up to
+	// prefetch_distance handles of a batch, unless the group starts and ends
+	// in the same chunk; a run like that is sequential enough for the
+	// hardware prefetcher, and checking for it once per group keeps ordered
+	// batches from paying for a prefetch test on every handle.
+	static void prefetch_slots(chunk* const* chunks, size_t chunk_count, const handle* ids, size_t count)
+	{
+		if (count > slot_map_detail::prefetch_distance)
+			count = slot_map_detail::prefetch_distance;
+		if (count == 0 || ((ids[0].index() ^ ids[count - 1].index()) >> chunk_shift) == 0)
+			return;
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			size_t chunk_index = ids[i].index() >> chunk_shift;
+			if (chunk_index < chunk_count)
+				slot_map_detail::prefetch(&chunk_layout::id(chunks[chunk_index], ids[i].index() & chunk_mask));
+		}
+	}
+
+	// destroy() for a handle into chunk c, minus the occupancy bit and the
+	// live count, which destroy_n batches.  returns false for stale handles.
+	bool release(chunk* c, handle id)
+	{
+		size_t slot = id.index() & chunk_mask;
+		handle& stored = chunk_layout::id(c, slot);
+		if (stored != id)
+			return false;
+
+		void* storage = chunk_layout::storage(c, slot);
+		static_cast<T*>(storage)->~T();
+		if (id.exhausted())
+		{
+			stored = handle();
+			return true;
+		}
+
+		stored = id.released();
+		*static_cast<unsigned*>(storage) = free_head;
+		free_head = id.index();
+		return true;
+	}
+
+	// collects the occupancy bits create_n sets and writes each 64-slot
+	// word back once, then adds to the live count on the way out, so a
+	// constructor throwing halfway through the batch still leaves the
+	// bitmap and the count matching the slots.  destroy_n clears its bits
+	// directly: a scattered batch jumps between words on every handle, and
+	// the mispredicted flushes cost more than the stores they save.
+	struct batch_marks
+	{
+		slot_map& map;
+		size_t word;
+		std::uint64_t bits;
+		size_t marked;
+
+		explicit batch_marks(slot_map& map) : map(map), word(0), bits(0), marked(0) {}
+
+		~batch_marks()
+		{
+			flush();
+			map.live_count += marked;
+		}
+
+		void mark(unsigned index)
+		{
+			if ((index >> 6) != word)
+			{
+				flush();
+				word = index >> 6;
+			}
+			bits |= std::uint64_t(1) << (index & 63);
+			++marked;
+		}
+
+		void flush()
+		{
+			if (bits == 0)
+				return;
+
+			map.occupancy[word] |= bits;
+			bits = 0;
+		}
+	};
+
+	// only ever reads the slot's handle, never its payload.
+	bool find(handle id)
+	{
+		unsigned index = id.index();
+		return (index >> chunk_shift) < table.size() && id_at(index) == id;
+	}
+
+	// only called when the free list is empty.  links the new chunk's slots
+	// in ascending order, so they're handed out in ascending order like v4.
+	// the reserved all-ones index is never linked.
+	bool grow()
+	{
+		std::uint64_t base = table.size() * ChunkSize;
+		if (base >= Layout::max_slots)
+			return false;
+
+		void* memory = allocator.allocate(sizeof(chunk), std::alignment_of<chunk>::value);
+		if (memory == nullptr)
+			return false;
+
+		// chunks released by shrink() pick up where their generations
+		// left off.
+		size_t chunk_index = table.size();
+		unsigned floor = chunk_index < generation_floor.size() ? generation_floor[chunk_index] : 0;
+
+		chunk* c = new (memory) chunk;
+		std::uint64_t end = base + ChunkSize < Layout::max_slots ? base + ChunkSize : Layout::max_slots;
+		for (unsigned i = 0; i < ChunkSize; ++i)
+		{
+			chunk_layout::id(c, i) = handle(Layout::index_mask, floor);
+			*static_cast<unsigned*>(chunk_layout::storage(c, i)) = base + i + 1 < end ? static_cast<unsigned>(base + i + 1) : empty_index;
+		}
+
+		// with a floor of generation_mask the slots above store the default
+		// handle.  that's fine for free slots, which are only ever reached
+		// through their own index, but the reserved slot is where a default
+		// handle points, so it gets a generation no handle can have.
+		if (end < base + ChunkSize)
+			chunk_layout::id(c, static_cast<unsigned>(end - base)) = handle(Layout::index_mask, 0);
+		occupancy.resize(static_cast<size_t>((end + 63) / 64), 0);
+		table.push_back(c);
+		free_head = static_cast<unsigned>(base);
+		return true;
+	}
+
+	void destroy_all()
+	{
+		if (std::is_trivially_destructible<T>::value || live_count == 0)
+			return;
+
+		for_each([](T& object) { object.~T(); });
+	}
+
+	Allocator allocator;
+	std::vector<chunk*> table;
+	// bit i is set while slot i holds a live object.
+	std::vector<std::uint64_t> occupancy;
+	std::vector<unsigned> generation_floor;
+	unsigned free_head;
+	size_t live_count;
+};
@@ -0,0 +1,202 @@
+#pragma once
+
+#include "DenseSlotMap.h"
+
+#include <vector>
+#include <tuple>
+#include <initializer_list>
+#include <utility>
+#include <cstddef>
+
+namespace slot_map_detail
+{
+	// C++11 stand-in for std::index_sequence, for walking the columns.
+	template <size_t... I> struct index_sequence {};
+
+	template <size_t N, size_t... I>
+	struct make_index_sequence : make_index_sequence<N - 1, N - 1, I...> {};
+
+	template <size_t... I>
+	struct make_index_sequence<0, I...> { typedef index_sequence<I...> type; };
+
+	// position of C in Ts..., as a compile error if C isn't in the list.
+	template <typename C, typename... Ts> struct type_index;
+
+	template <typename C, typename... Ts>
+	struct type_index<C, C, Ts...> { static const size_t value = 0; };
+
+	template <typename C, typename T, typename... Ts>
+	struct type_index<C, T, Ts...> { static const size_t value = 1 + type_index<C, Ts...>::value; };
+
+	// expands a pack expression for its side effects, in order.
+	inline void expand(std::initializer_list<int>) {}
+}
+
+// structure-of-arrays variant of the packed slot map.  instead of one array of
+// structs, every component type gets its own contiguous column, and all of
+// the columns are kept packed and in the same order, so position i in every
+// column belongs to the same object.  handles use the same index/generation
+// scheme as v4::object_id, or whatever handle_layout is given.
+// a pass that only needs one component walks one column and nothing else,
+// which is also the layout SIMD loops want:
+//
+//    float* x = bodies.column<position_x>();
+//    const float* vx = bodies.column<velocity_x>();
+//    for (size_t i = 0; i < bodies.size(); ++i)
+//        x[i] += vx[i] * dt;
+//
+// components are looked up by type, so each type can only appear once in the
+// list; wrap scalars in small structs if two columns need the same type.
+template <typename Layout, typename... Components>
+class basic_soa_slot_map
+{
+	typedef typename slot_map_detail::make_index_sequence<sizeof...(Components)>::type columns_sequence;
+
+public:
+	typedef slot_handle<basic_soa_slot_map, Layout> handle;
+
+	// appends a new object with default constructed components.  returns a
+	// default handle if every index the handle layout allows is in use.
+	handle create()
+	{
+		if (index.full())
+			return handle();
+
+		index.prepare();
+		reserve_columns(columns_sequence());
+		column_rollback rollback(*this);
+		push_defaults(columns_sequence(), rollback);
+		rollback.pushed = 0;
+		return index.push();
+	}
+
+	// appends a new object with the given value for every component.
+	handle create(const Components&... values)
+	{
+		if (index.full())
+			return handle();
+
+		index.prepare();
+		reserve_columns(columns_sequence());
+		column_rollback rollback(*this);
+		push_values(columns_sequence(), rollback, values...);
+		rollback.pushed = 0;
+		return index.push();
+	}
+
+	// one component of one object, via the indirection table.  returns
+	// nullptr for stale handles.
+	template <typename C>
+	C* get(handle id)
+	{
+		unsigned position;
+		return index.find(id, position) ? &column<C>()[position] : nullptr;
+	}
+
+	bool contains(handle id) const
+	{
+		unsigned position;
+		return index.find(id, position);
+	}
+
+	// swap-and-pop on every column.  destroying a stale handle is a no-op.
+	void destroy(handle id)
+	{
+		unsigned position;
+		if (!index.find(id, position))
+			return;
+
+		erase_columns(columns_sequence(), position);
+		index.erase(position);
+	}
+
+	size_t size() const { return index.size(); }
+	bool empty() const { return index.size() == 0; }
+
+	// the packed column for a component type; size() elements long, and
+	// only valid until the next create or destroy.
+	template <typename C>
+	C* column()
+	{
+		return std::get<slot_map_detail::type_index<C, Components...>::value>(columns).data();
+	}
+
+	template <typename C>
+	const C* column() const
+	{
+		return std::get<slot_map_detail::type_index<C, Components...>::value>(columns).data();
+	}
+
+	// handle of the object at the given position in the columns.
+	handle handle_at(size_t position) const { return index.handle_at(position); }
+
+private:
+	// pops the first pushed columns back off on the way out, so a component
+	// constructor that throws partway through create() leaves every column
+	// the same length.  create() zeroes pushed once all of them are in.
+	struct column_rollback
+	{
+		basic_soa_slot_map& map;
+		size_t pushed;
+
+		explicit column_rollback(basic_soa_slot_map& map) : map(map), pushed(0) {}
+		~column_rollback() { map.pop_columns(columns_sequence(), pushed); }
+	};
+
+	// grows every full column before anything is pushed, the same way
+	// dense_slot_index::prepare() does for its handles, so running out of
+	// memory can't leave one column longer than the others.
+	template <size_t... I>
+	void reserve_columns(slot_map_detail::index_sequence<I...>)
+	{
+		slot_map_detail::expand({ (reserve_column(std::get<I>(columns)), 0)... });
+	}
+
+	template <typename C>
+	static void reserve_column(std::vector<C>& values)
+	{
+		if (values.size() == values.capacity())
+			values.reserve(values.size() * 2 + 1);
+	}
+
+	template <size_t... I>
+	void push_defaults(slot_map_detail::index_sequence<I...>, column_rollback& rollback)
+	{
+		slot_map_detail::expand({ (std::get<I>(columns).emplace_back(), ++rollback.pushed, 0)... });
+	}
+
+	template <size_t... I>
+	void push_values(slot_map_detail::index_sequence<I...>, column_rollback& rollback, const Components&... values)
+	{
+		slot_map_detail::expand({ (std::get<I>(columns).push_back(values), ++rollback.pushed, 0)... });
+	}
+
+	template <size_t... I>
+	void pop_columns(slot_map_detail::index_sequence<I...>, size_t count)
+	{
+		slot_map_detail::expand({ (I < count ? (std::get<I>(columns).pop_back(), 0) : 0)... });
+	}
+
+	template <size_t... I>
+	void erase_columns(slot_map_detail::index_sequence<I...>, unsigned position)
+	{
+		slot_map_detail::expand({ (erase_at(std::get<I>(columns), position), 0)... });
+	}
+
+	template <typename C>
+	static void erase_at(std::vector<C>& values, unsigned position)
+	{
+		if (position != values.size() - 1)
+			values[position] = std::move(values.back());
+		values.pop_back();
+	}
+
+	std::tuple<std::vector<Components>...> columns;
+	dense_slot_index<handle> index;
+};
+
+// the common case, with the default 32/32 handle layout.  there's no way to
+// give a defaulted Layout parameter after the component pack, hence the
+// basic_ version for other layouts.
+template <typename... Components>
+using soa_slot_map = basic_soa_slot_map<handle_layout<>, Components...>;
@@ -0,0 +1,199 @@
+#pragma once
+
+#include "SlotMap.h"
+
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+// slot_map that records what changed since the last clear_changes(), for
+// replication and incremental saves that only want to look at the objects
+// that changed this frame instead of diffing all of them.
+// three sets are kept, one bit per slot each: created, destroyed, and
+// modified.  they're netted out as they go, so each slot ends the frame in
+// one of the states a remote copy cares about:
+//  - created: a new object, send all of it.
+//  - modified: an existing object, changed through modify().
+//  - destroyed: the object the remote copy has in this slot is gone.
+//  - destroyed and created: the slot was destroyed and re-created; the new
+//    handle's generation tells the two objects apart.
+// an object created and destroyed within the same frame never shows up at
+// all.  on top of the per-slot bits, a summary bitmap has one bit per 64
+// slots, so walking the changes and clearing them costs O(changes) rather
+// than O(capacity), and a quiet chunk is never looked at.
+// only changes made through this wrapper are seen; modify() is how to get
+// a mutable pointer, get() is read-only.
+template <typename T, size_t ChunkSize = 256, typename Layout = handle_layout<>, typename Allocator = heap_chunk_allocator, typename SlotLayout = interleaved_slots>
+class tracked_slot_map
+{
+public:
+	typedef slot_map<T, ChunkSize, Layout, Allocator, SlotLayout> map_type;
+	typedef typename map_type::handle handle;
+
+	explicit tracked_slot_map(const Allocator& allocator = Allocator()) : objects(allocator) {}
+
+	template <typename... Args>
+	handle create(Args&&... args)
+	{
+		handle id = objects.create(std::forward<Args>(args)...);
+		if (id != handle())
+		{
+			mark(created, id.index());
+			unmark(modified, id.index());
+		}
+		return id;
+	}
+
+	const T* get(handle id) const { return objects.get(id); }
+
+	// same as get, but records the object as modified.
+	T* modify(handle id)
+	{
+		T* object = objects.get(id);
+		if (object != nullptr && !test(created, id.index()))
+			mark(modified, id.index());
+		return object;
+	}
+
+	void destroy(handle id)
+	{
+		if (objects.get(id) == nullptr)
+			return;
+
+		objects.destroy(id);
+		unsigned index = id.index();
+		unmark(modified, index);
+		if (test(created, index))
+			unmark(created, index);
+		else
+			mark(destroyed, index);
+	}
+
+	size_t size() const { return objects.size(); }
+
+	// read-only access to everything else slot_map offers (iteration,
+	// get_n, save, and so on).
+	const map_type& map() const { return objects; }
+
+	// function(handle, const T&) for every object created since the last
+	// clear_changes() and still alive, in slot order.
+	template <typename Function>
+	void for_each_created(Function function) const
+	{
+		for_each_live(created, function);
+	}
+
+	// function(handle, const T&) for every object modified since the last
+	// clear_changes(); objects that are also new this frame are only
+	// reported as created.
+	template <typename Function>
+	void for_each_modified(Function function) const
+	{
+		for_each_live(modified, function);
+	}
+
+	// function(unsigned index) for every slot whose previous object was
+	// destroyed since the last clear_changes().  the slot may already hold
+	// a new object, which for_each_created reports with its new handle.
+	template <typename Function>
+	void for_each_destroyed(Function function) const
+	{
+		for_each_bit(destroyed, function);
+	}
+
+	bool has_changes() const
+	{
+		for (size_t i = 0; i < summary.size(); ++i)
+			if (summary[i] != 0)
+				return true;
+		return false;
+	}
+
+	// forgets every recorded change, typically once a frame after
+	// replication has sent them.
+	void clear_changes()
+	{
+		for (size_t s = 0; s < summary.size(); ++s)
+		{
+			for (std::uint64_t bits = summary[s]; bits != 0; bits &= bits - 1)
+			{
+				size_t word = s * 64 + slot_map_detail::lowest_bit(bits);
+				created[word] = 0;
+				destroyed[word] = 0;
+				modified[word] = 0;
+			}
+			summary[s] = 0;
+		}
+	}
+
+private:
+	typedef std::vector<std::uint64_t> bitmap;
+
+	// the three sets grow together, on demand, and the summary bit for a
+	// word is set whenever any of them has a bit set in it.
+	void mark(bitmap& set, unsigned index)
+	{
+		size_t word = index >> 6;
+		if (word >= created.size())
+		{
+			created.resize(word + 1, 0);
+			destroyed.resize(word + 1, 0);
+			modified.resize(word + 1, 0);
+			summary.resize(word / 64 + 1, 0);
+		}
+
+		set[word] |= std::uint64_t(1) << (index & 63);
+		summary[word >> 6] |= std::uint64_t(1) << (word & 63);
+	}
+
+	// clears the summary bit once all three words are clear again, so an
+	// object created and destroyed in the same frame leaves has_changes()
+	// false.
+	void unmark(bitmap& set, unsigned index)
+	{
+		size_t word = index >> 6;
+		if (word >= set.size())
+			return;
+
+		set[word] &= ~(std::uint64_t(1) << (index & 63));
+		if ((created[word] | destroyed[word] | modified[word]) == 0)
+			summary[word >> 6] &= ~(std::uint64_t(1) << (word & 63));
+	}
+
+	static bool test(const bitmap& set, unsigned index)
+	{
+		size_t word = index >> 6;
+		return word < set.size() && (set[word] & (std::uint64_t(1) << (index & 63))) != 0;
+	}
+
+	template <typename Function>
+	void for_each_bit(const bitmap& set, Function function) const
+	{
+		for (size_t s = 0; s < summary.size(); ++s)
+		{
+			for (std::uint64_t words = summary[s]; words != 0; words &= words - 1)
+			{
+				size_t word = s * 64 + slot_map_detail::lowest_bit(words);
+				for (std::uint64_t bits = set[word]; bits != 0; bits &= bits - 1)
+					function(static_cast<unsigned>(word * 64 + slot_map_detail::lowest_bit(bits)));
+			}
+		}
+	}
+
+	template <typename Function>
+	void for_each_live(const bitmap& set, Function function) const
+	{
+		for_each_bit(set, [this, &function](unsigned index)
+		{
+			handle id = objects.handle_at(index);
+			function(id, *objects.get(id));
+		});
+	}
+
+	map_type objects;
+	bitmap created;
+	bitmap destroyed;
+	bitmap modified;
+	bitmap summary;
+};